@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+#ifndef _BENCH_SUPPORT_HPP_
+#define _BENCH_SUPPORT_HPP_
+
+namespace oasis::bench
+{
+    // Measures the time since it was created or last restarted.
+    class stopwatch
+    {
+    private:
+        std::chrono::steady_clock::time_point _start;
+
+    public:
+        stopwatch() : _start(std::chrono::steady_clock::now())
+        {
+        }
+
+        void restart()
+        {
+            _start = std::chrono::steady_clock::now();
+        }
+
+        [[nodiscard]] double seconds() const
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+        }
+    };
+
+    // A fast generator of repeatable data, the same seed always gives the same sequence.
+    inline uint64_t next_random(uint64_t& state)
+    {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    // Writes a file of the given size filled from the seed, so two files written with the same seed are duplicates.
+    inline void write_file(const boost::filesystem::path& p, uintmax_t size, uint64_t seed)
+    {
+        std::vector<uint64_t> block(8192);
+        std::ofstream out(p.string(), std::ios::binary | std::ios::trunc);
+        while (size > 0)
+        {
+            for (auto& word : block)
+            {
+                word = next_random(seed);
+            }
+            auto length = static_cast<std::size_t>(std::min<uintmax_t>(size, block.size() * sizeof(uint64_t)));
+            out.write(reinterpret_cast<const char *>(block.data()), static_cast<std::streamsize>(length));
+            size -= length;
+        }
+        if (!out) throw std::runtime_error("Cannot write " + p.string());
+    }
+
+    // Fills a directory that does not exist yet with pairs of identical files, returns false if it was already there.
+    inline bool make_pairs(const boost::filesystem::path& dir, unsigned int pairs, uintmax_t size)
+    {
+        if (boost::filesystem::exists(dir)) return false;
+        boost::filesystem::create_directories(dir);
+        for (unsigned int i = 0; i < pairs; i++)
+        {
+            auto name = std::to_string(i);
+            write_file(dir / ("a" + name), size, i + 1);
+            write_file(dir / ("b" + name), size, i + 1);
+        }
+        return true;
+    }
+
+    // Empties the page cache so the next run reads from the device, which needs root on Linux.
+    inline bool drop_caches()
+    {
+#if defined(__linux__)
+        sync();
+        std::ofstream out("/proc/sys/vm/drop_caches");
+        out << "3" << std::endl;
+        return static_cast<bool>(out);
+#else
+        return false;
+#endif
+    }
+}
+
+#endif //_BENCH_SUPPORT_HPP_
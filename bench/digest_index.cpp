@@ -0,0 +1,122 @@
+// Insert time and memory of the result sets held as std::map<digest_key, std::set<id>>, as
+// std::map<digest_key, std::vector<id>>, and as a digest_index, whose finish() is timed as well.
+//
+// Usage: digest_index [files = 1000000 10000000]
+//
+// The files are in sets of two with 64 byte digests and arrive in random order, so every set is made by one insert and
+// completed by another far from it. Memory is the heap taken by the sets, the path store is left out. Each count of
+// files is run for every layout in turn. 50000000 files take about 4 GB with digest_index, more than twice that with
+// either map.
+
+#include <cstdlib>
+#include <map>
+#include <malloc.h>
+#include <new>
+#include <set>
+// foundation.hpp, which the index includes, expects Boost.Regex to be included before it.
+#include <boost/regex.hpp>
+#include "digest_index.hpp"
+#include "bench_support.hpp"
+
+using namespace oasis;
+using namespace oasis::filesystem;
+
+static std::size_t allocated = 0;
+
+// The replacements are kept out of line, where the compiler cannot mistake them for a mismatched malloc and delete.
+[[gnu::noinline]] void *operator new(std::size_t size)
+{
+    if (void *p = std::malloc(size ? size : 1))
+    {
+        allocated += malloc_usable_size(p);
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void *p) noexcept
+{
+    if (p != nullptr) allocated -= malloc_usable_size(p);
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void *p, std::size_t) noexcept
+{
+    if (p != nullptr) allocated -= malloc_usable_size(p);
+    std::free(p);
+}
+
+// The key of a set, made from its number alone so it need not be kept.
+static digest_key key_of(uint32_t set)
+{
+    uint64_t state = set;
+    uint64_t digest[8];
+    for (auto& word : digest)
+    {
+        word = bench::next_random(state);
+    }
+    return digest_key(4096, reinterpret_cast<const uint8_t *>(digest), sizeof(digest));
+}
+
+template<typename FuncT>
+static void run(const char *name, const std::vector<uint32_t>& files, FuncT insert)
+{
+    auto before = allocated;
+    bench::stopwatch watch;
+    for (auto file : files)
+    {
+        insert(key_of(file / 2), file);
+    }
+    double seconds = watch.seconds();
+    std::printf("%-22s %10zu files %8.0f ns per insert %6.1f bytes per file", name, files.size(), seconds / files.size() * 1e9, static_cast<double>(allocated - before) / files.size());
+    std::fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::size_t> counts;
+    for (int i = 1; i < argc; i++)
+    {
+        counts.push_back(std::stoull(argv[i]));
+    }
+    if (counts.empty()) counts = { 1000000, 10000000 };
+
+    for (auto count : counts)
+    {
+        // File i is in set i / 2, the files are shuffled so the two of a set arrive apart.
+        std::vector<uint32_t> files(count);
+        for (std::size_t i = 0; i < count; i++)
+        {
+            files[i] = static_cast<uint32_t>(i);
+        }
+        uint64_t state = count;
+        for (std::size_t i = count; i > 1; i--)
+        {
+            std::swap(files[i - 1], files[bench::next_random(state) % i]);
+        }
+
+        {
+            std::map<digest_key, std::set<path_store::id_type>> sets;
+            run("map<key, set<id>>", files, [&](const digest_key& key, uint32_t id) { sets[key].insert(id); });
+            std::printf("\n");
+        }
+        {
+            std::map<digest_key, std::vector<path_store::id_type>> sets;
+            run("map<key, vector<id>>", files, [&](const digest_key& key, uint32_t id)
+            {
+                auto& members = sets[key];
+                if (std::find(members.begin(), members.end(), id) == members.end()) members.push_back(id);
+            });
+            std::printf("\n");
+        }
+        {
+            digest_index sets;
+            run("digest_index", files, [&](const digest_key& key, uint32_t id) { sets.insert(sets.find_or_add(key), id, false); });
+            bench::stopwatch watch;
+            sets.finish([](path_store::id_type *first, std::size_t count) { std::sort(first, first + count); });
+            std::printf(", finish %.2f s, %.1f bytes per file after it\n", watch.seconds(), static_cast<double>(sets.memory_used()) / count);
+        }
+    }
+
+    return 0;
+}
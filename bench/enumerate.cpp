@@ -0,0 +1,114 @@
+// Reading one large directory with boost::filesystem::directory_iterator and with directory_enumerator, counting the
+// time and the heap allocations of each.
+//
+// Usage: enumerate <directory> [entries = 1000000]
+//
+// The directory is filled with empty files if it does not exist, and used as it is otherwise. Each way is run five
+// times and the best time is kept, so the directory is in the cache.
+
+#include <cstdlib>
+#include <new>
+// foundation.hpp, which the enumerator includes, expects Boost.Regex to be included before it.
+#include <boost/regex.hpp>
+#include "directory_enumerator.hpp"
+#include "bench_support.hpp"
+
+using namespace oasis;
+using namespace oasis::filesystem;
+
+static std::size_t allocations = 0;
+
+// The replacements are kept out of line, where the compiler cannot mistake them for a mismatched malloc and delete.
+[[gnu::noinline]] void *operator new(std::size_t size)
+{
+    allocations++;
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+template<typename FuncT>
+static void run(const char *name, FuncT read)
+{
+    double best = 0;
+    std::size_t entries = 0;
+    std::size_t allocated = 0;
+    for (int round = 0; round < 5; round++)
+    {
+        auto before = allocations;
+        bench::stopwatch watch;
+        entries = read();
+        double seconds = watch.seconds();
+        allocated = allocations - before;
+        if ((round == 0) || (seconds < best)) best = seconds;
+    }
+    std::printf("%-38s %9zu entries %8.1f ms %10zu allocations\n", name, entries, best * 1000, allocated);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "Usage: %s <directory> [entries]\n", argv[0]);
+        return 2;
+    }
+    boost::filesystem::path dir(argv[1]);
+    std::size_t count = (argc > 2) ? std::stoull(argv[2]) : 1000000;
+    if (!boost::filesystem::exists(dir))
+    {
+        boost::filesystem::create_directories(dir);
+        for (std::size_t i = 0; i < count; i++)
+        {
+            std::ofstream((dir / ("file" + std::to_string(i))).string());
+        }
+        std::printf("Created %zu empty files in %s\n", count, dir.string().c_str());
+    }
+
+    // Every way touches what it reads, so none of it can be left out.
+    boost::system::error_code ec;
+    std::size_t touched = 0;
+    run("boost directory_iterator", [&]()
+    {
+        std::size_t n = 0;
+        for (boost::filesystem::directory_iterator it(dir), end; it != end; ++it)
+        {
+            touched += it->path().native().size();
+            n++;
+        }
+        return n;
+    });
+    run("directory_enumerator, current()", [&]()
+    {
+        std::size_t n = 0;
+        directory_enumerator e(dir);
+        while (e.move_next(ec))
+        {
+            touched += e.current().native().size();
+            n++;
+        }
+        return n;
+    });
+    run("directory_enumerator, name/type/inode", [&]()
+    {
+        std::size_t n = 0;
+        directory_enumerator e(dir);
+        while (e.move_next(ec))
+        {
+            touched += e.name().size() + (e.type() == entry_type::file) + e.inode();
+            n++;
+        }
+        return n;
+    });
+    if (touched == 0) std::printf("The directory is empty\n");
+
+    return 0;
+}
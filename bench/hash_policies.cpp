@@ -0,0 +1,68 @@
+// Throughput of each hash policy, on a buffer in memory and when scanning a tree of duplicate pairs.
+//
+// Usage: hash_policies <directory> [pairs = 16] [MiB per file = 32]
+//
+// The directory is filled with the pairs if it does not exist, and used as it is otherwise. Put it on tmpfs to take
+// the device out of the measurement.
+
+#include "duplicate_files_scanner.hpp"
+#include "bench_support.hpp"
+
+using namespace oasis;
+using namespace oasis::filesystem;
+
+template<typename HashT>
+void run(const boost::filesystem::path& dir)
+{
+    // Hashing alone, a 64 MiB buffer eight times over.
+    std::vector<uint8_t> buffer(67108864);
+    uint64_t seed = 1;
+    for (auto& b : buffer)
+    {
+        b = static_cast<uint8_t>(bench::next_random(seed));
+    }
+    uint8_t digest[HashT::digest_size];
+    HashT hasher;
+    bench::stopwatch watch;
+    for (int i = 0; i < 8; i++)
+    {
+        hasher.reset();
+        hasher.update(buffer.data(), buffer.size());
+        hasher.finish(digest);
+    }
+    double memory = (8.0 * buffer.size()) / watch.seconds() / 1e9;
+
+    // The whole scan on one hashing thread, so the figure is comparable with the one above.
+    duplicate_files_scanner<sort_by_filename, HashT> scanner(dir);
+    scanner.set_hashing_threads(1);
+    watch.restart();
+    scanner.perform_scan(true);
+    double seconds = watch.seconds();
+
+    std::printf("%-12s memory %6.2f GB/s   scan %6.2f GB/s   %zu sets, %ju bytes read in %.2f s\n", HashT::name().c_str(), memory, scanner.bytes_read() / seconds / 1e9, scanner.size(), static_cast<uintmax_t>(scanner.bytes_read()), seconds);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "Usage: %s <directory> [pairs] [MiB per file]\n", argv[0]);
+        return 2;
+    }
+    boost::filesystem::path dir(argv[1]);
+    unsigned int pairs = (argc > 2) ? static_cast<unsigned int>(std::stoul(argv[2])) : 16;
+    uintmax_t size = ((argc > 3) ? std::stoull(argv[3]) : 32) * 1048576;
+    if (bench::make_pairs(dir, pairs, size)) std::printf("Created %u pairs of %ju MiB files in %s\n", pairs, size / 1048576, dir.string().c_str());
+
+    run<sha512_hash>(dir);
+    run<sha256_hash>(dir);
+    run<blake2b_hash>(dir);
+#if defined(OASIS_HAVE_BLAKE3)
+    run<blake3_hash>(dir);
+#endif
+#if defined(OASIS_HAVE_XXHASH)
+    run<xxh3_128_hash>(dir);
+#endif
+
+    return 0;
+}
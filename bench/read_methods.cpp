@@ -0,0 +1,89 @@
+// Scan times with blocking reads against io_uring at several queue depths.
+//
+// Usage: read_methods <directory> [--drop-caches] [pairs = 16] [MiB per file = 32]
+//
+// The directory is filled with the pairs if it does not exist, and used as it is otherwise. With --drop-caches the
+// page cache is emptied before every run, which needs root, so the reads reach the device.
+
+#include "duplicate_files_scanner.hpp"
+#include "bench_support.hpp"
+
+using namespace oasis;
+using namespace oasis::filesystem;
+
+// A digest of the sets found, so the runs can be checked against each other.
+static std::size_t fingerprint(duplicate_files_scanner<>& scanner)
+{
+    std::string all;
+    for (auto it = scanner.begin(); it != scanner.end(); ++it)
+    {
+        for (const auto& p : *it)
+        {
+            all += p.string() + "\n";
+        }
+        all += "\n";
+    }
+    return std::hash<std::string>{}(all);
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> args;
+    bool drop = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--drop-caches")
+        {
+            drop = true;
+            continue;
+        }
+        args.emplace_back(argv[i]);
+    }
+    if (args.empty())
+    {
+        std::fprintf(stderr, "Usage: %s <directory> [--drop-caches] [pairs] [MiB per file]\n", argv[0]);
+        return 2;
+    }
+    boost::filesystem::path dir(args[0]);
+    unsigned int pairs = (args.size() > 1) ? static_cast<unsigned int>(std::stoul(args[1])) : 16;
+    uintmax_t size = ((args.size() > 2) ? std::stoull(args[2]) : 32) * 1048576;
+    if (bench::make_pairs(dir, pairs, size)) std::printf("Created %u pairs of %ju MiB files in %s\n", pairs, size / 1048576, dir.string().c_str());
+    if (!uring_file_reader::available()) std::printf("io_uring is not available, those runs fall back to blocking reads\n");
+
+    struct method
+    {
+        const char *name;
+        read_method read;
+        unsigned int depth;
+    };
+    const method methods[] = {
+        { "buffered", read_method::buffered, 0 },
+        { "io_uring, depth 1", read_method::io_uring, 1 },
+        { "io_uring, depth 32", read_method::io_uring, 32 },
+    };
+
+    std::size_t expected = 0;
+    for (int round = 0; round < 2; round++)
+    {
+        for (const auto& m : methods)
+        {
+            if (drop && !bench::drop_caches())
+            {
+                std::fprintf(stderr, "The page cache cannot be dropped, run as root or without --drop-caches\n");
+                return 1;
+            }
+            duplicate_files_scanner<> scanner(dir);
+            scanner.set_file_read_method(m.read);
+            if (m.depth != 0) scanner.set_io_queue_depth(m.depth);
+            bench::stopwatch watch;
+            scanner.perform_scan(true);
+            double seconds = watch.seconds();
+
+            auto found = fingerprint(scanner);
+            if (expected == 0) expected = found;
+            std::printf("%-20s %8.1f ms   %ju bytes, reads buffered/io_uring %ju/%ju%s\n", m.name, seconds * 1000, static_cast<uintmax_t>(scanner.bytes_read()), static_cast<uintmax_t>(scanner.files_read(read_method::buffered)), static_cast<uintmax_t>(scanner.files_read(read_method::io_uring)), (found == expected) ? "" : "   DIFFERENT SETS");
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,77 @@
+// The fixed cost of hashing a file, and a scan of a tree of small files where that cost adds up.
+//
+// Usage: small_files <directory> [files = 100000] [digests = 1000000]
+//
+// The directory is filled with files of 1 to 4 KiB if it does not exist, a thousand to a sub-directory, 4% of them
+// in identical pairs. It is used as it is otherwise.
+
+#include "duplicate_files_scanner.hpp"
+#include "bench_support.hpp"
+
+using namespace oasis;
+using namespace oasis::filesystem;
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "Usage: %s <directory> [files] [digests]\n", argv[0]);
+        return 2;
+    }
+    boost::filesystem::path dir(argv[1]);
+    std::size_t files = (argc > 2) ? std::stoull(argv[2]) : 100000;
+    std::size_t digests = (argc > 3) ? std::stoull(argv[3]) : 1000000;
+
+    // A context created and destroyed for every digest, as for every file before contexts were kept per thread, against
+    // one context that is reset.
+    uint8_t data[100] = {};
+    uint8_t digest[sha512_hash::digest_size];
+    bench::stopwatch watch;
+    for (std::size_t i = 0; i < digests; i++)
+    {
+        data[0] = static_cast<uint8_t>(i);
+        sha512_hash hasher;
+        hasher.update(data, sizeof(data));
+        hasher.finish(digest);
+    }
+    double created = watch.seconds();
+    sha512_hash reused;
+    watch.restart();
+    for (std::size_t i = 0; i < digests; i++)
+    {
+        data[0] = static_cast<uint8_t>(i);
+        reused.reset();
+        reused.update(data, sizeof(data));
+        reused.finish(digest);
+    }
+    double reset = watch.seconds();
+    std::printf("%zu digests of 100 bytes: new context %.0f ns, reused context %.0f ns each\n", digests, created / digests * 1e9, reset / digests * 1e9);
+
+    if (!boost::filesystem::exists(dir))
+    {
+        std::size_t pairs = files / 50;
+        for (std::size_t i = 0; i < files; i++)
+        {
+            auto sub = dir / std::to_string(i / 1000);
+            if (i % 1000 == 0) boost::filesystem::create_directories(sub);
+            // Each of the first pairs is an even file and the odd file after it, written from the same seed.
+            bool second = (i < pairs * 2) && (i % 2 == 1);
+            auto seed = second ? i : (i + 1);
+            uint64_t size_state = seed;
+            auto size = 1024 + (bench::next_random(size_state) % 3073);
+            bench::write_file(sub / std::to_string(i), size, seed);
+        }
+        std::printf("Created %zu files, %zu of them in pairs, in %s\n", files, pairs * 2, dir.string().c_str());
+    }
+
+    for (int round = 0; round < 3; round++)
+    {
+        duplicate_files_scanner<> scanner(dir);
+        watch.restart();
+        scanner.perform_scan(true);
+        double seconds = watch.seconds();
+        std::printf("scan: %.2f s, %ju files examined, %ju hashed, %zu sets, %.1f us per file examined\n", seconds, static_cast<uintmax_t>(scanner.files_examined()), static_cast<uintmax_t>(scanner.files_hashed()), scanner.size(), seconds / scanner.files_examined() * 1e6);
+    }
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+// The system calls a scan makes for each file, counted by tracing it, with the path based walk and with the walk
+// relative to open directories that classifies entries by d_type and examines each file with one statx().
+//
+// Usage: syscalls <directory> [depth = 13] [files per directory = 10]
+//
+// The directory is filled with a binary tree of directories of the given depth, each holding the given number of
+// small files, if it does not exist. It is used as it is otherwise. One walker is used and the minimum size is set
+// so that nothing is hashed, so the calls counted are those of the walk and of examining the files. Linux only, the
+// scan runs in a child process traced with ptrace, so its times are much longer than untraced ones.
+
+#include <map>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include "duplicate_files_scanner.hpp"
+#include "bench_support.hpp"
+
+using namespace oasis;
+using namespace oasis::filesystem;
+
+static void make_tree(const boost::filesystem::path& dir, unsigned int depth, unsigned int files)
+{
+    boost::filesystem::create_directories(dir);
+    for (unsigned int i = 0; i < files; i++)
+    {
+        std::ofstream((dir / ("f" + std::to_string(i))).string()) << i;
+    }
+    if (depth <= 1) return;
+    make_tree(dir / "l", depth - 1, files);
+    make_tree(dir / "r", depth - 1, files);
+}
+
+static const char *syscall_name(uint64_t nr)
+{
+    switch (nr)
+    {
+        case SYS_openat: return "openat";
+        case SYS_close: return "close";
+        case SYS_getdents64: return "getdents64";
+        case SYS_statx: return "statx";
+        case SYS_fstat: return "fstat";
+        case SYS_newfstatat: return "newfstatat";
+#if defined(SYS_stat)
+        case SYS_stat: return "stat";
+        case SYS_lstat: return "lstat";
+        case SYS_readlink: return "readlink";
+#endif
+        case SYS_readlinkat: return "readlinkat";
+        case SYS_getcwd: return "getcwd";
+        case SYS_read: return "read";
+        case SYS_futex: return "futex";
+        case SYS_mmap: return "mmap";
+        case SYS_munmap: return "munmap";
+        case SYS_brk: return "brk";
+        default: return nullptr;
+    }
+}
+
+// Scans the directory in a traced child, and returns the number of files it examined.
+static uintmax_t trace_scan(const boost::filesystem::path& dir, bool relative, std::map<uint64_t, uintmax_t>& counts)
+{
+    int results[2];
+    if (pipe(results) != 0) throw std::system_error(errno, std::generic_category());
+
+    // The child would print whatever is still buffered a second time.
+    std::fflush(stdout);
+    pid_t child = fork();
+    if (child == 0)
+    {
+        // Everything but the scan itself is done before the child stops to be traced.
+        close(results[0]);
+        duplicate_files_scanner<> scanner(dir);
+        scanner.set_traversal_threads(1);
+        scanner.set_relative_traversal(relative);
+        scanner.set_minimum_size(std::numeric_limits<size_t>::max());
+        ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        raise(SIGSTOP);
+        bench::stopwatch watch;
+        scanner.perform_scan(true);
+        double seconds = watch.seconds();
+        uintmax_t examined = scanner.files_examined();
+        std::printf("%-14s %9.0f ms traced, ", relative ? "relative walk" : "path based", seconds * 1000);
+        std::fflush(stdout);
+        if (write(results[1], &examined, sizeof(examined)) != sizeof(examined)) _exit(1);
+        _exit(0);
+    }
+    close(results[1]);
+
+    int status;
+    waitpid(child, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, child, nullptr, PTRACE_O_TRACECLONE | PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, child, nullptr, nullptr);
+    for (;;)
+    {
+        pid_t thread = waitpid(-1, &status, __WALL);
+        if (thread < 0) break;
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+        {
+            if (thread == child) break;
+            continue;
+        }
+
+        // Calls are counted as they are entered, other signals are passed on.
+        int signal = 0;
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+        {
+            __ptrace_syscall_info info{};
+            if ((ptrace(PTRACE_GET_SYSCALL_INFO, thread, sizeof(info), &info) > 0) && (info.op == PTRACE_SYSCALL_INFO_ENTRY)) counts[info.entry.nr]++;
+        }
+        else if ((WSTOPSIG(status) != SIGTRAP) && (WSTOPSIG(status) != SIGSTOP))
+        {
+            signal = WSTOPSIG(status);
+        }
+        ptrace(PTRACE_SYSCALL, thread, nullptr, signal);
+    }
+
+    uintmax_t examined = 0;
+    if (read(results[0], &examined, sizeof(examined)) != sizeof(examined)) examined = 0;
+    close(results[0]);
+    return examined;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "Usage: %s <directory> [depth] [files per directory]\n", argv[0]);
+        return 2;
+    }
+    boost::filesystem::path dir(argv[1]);
+    unsigned int depth = (argc > 2) ? static_cast<unsigned int>(std::stoul(argv[2])) : 13;
+    unsigned int files = (argc > 3) ? static_cast<unsigned int>(std::stoul(argv[3])) : 10;
+    if (!boost::filesystem::exists(dir))
+    {
+        make_tree(dir, depth, files);
+        std::printf("Created %u directories holding %u files in %s\n", (1U << depth) - 1, ((1U << depth) - 1) * files, dir.string().c_str());
+    }
+
+    for (bool relative : { false, true })
+    {
+        std::map<uint64_t, uintmax_t> counts;
+        auto examined = trace_scan(dir, relative, counts);
+        if (examined == 0)
+        {
+            std::printf("the scan failed\n");
+            return 1;
+        }
+
+        uintmax_t total = 0;
+        for (const auto& c : counts)
+        {
+            total += c.second;
+        }
+        std::printf("%ju files, %ju system calls, %.2f per file:", examined, total, static_cast<double>(total) / examined);
+        for (const auto& c : counts)
+        {
+            if ((c.second * 100 < total) && (c.second < examined)) continue;
+            auto name = syscall_name(c.first);
+            if (name != nullptr)
+            {
+                std::printf(" %s %ju", name, c.second);
+            }
+            else
+            {
+                std::printf(" #%ju %ju", static_cast<uintmax_t>(c.first), c.second);
+            }
+        }
+        std::printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,291 @@
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <boost/thread.hpp>
+#if __has_include(<sys/mman.h>)
+#include <sys/mman.h>
+#endif
+
+#ifndef _BUFFER_POOL_HPP_
+#define _BUFFER_POOL_HPP_
+
+namespace oasis
+{
+    /**********************************************************************************************//**
+     * @class	buffer_pool buffer_pool.hpp
+     *
+     * @brief	A pool of equally sized, page aligned I/O buffers with a hard limit on the memory they
+     * 			may occupy.
+     *
+     * 			Buffers are created on demand and kept when they are returned, so a long scan touches
+     * 			the allocator and faults in fresh pages only until the pool has reached its working
+     * 			size. The most recently returned buffer is handed out first, while its pages are still
+     * 			resident. When the limit has been reached acquire() blocks until another thread
+     * 			returns a buffer; try_acquire() never blocks.
+     *
+     * 			When huge pages are requested each buffer is rounded up to a multiple of 2 MiB and
+     * 			backed by explicit huge pages if the system has any reserved, or else marked as
+     * 			eligible for transparent huge pages.
+     **************************************************************************************************/
+
+    class buffer_pool
+    {
+    private:
+        static constexpr std::size_t _page_size = 4096;
+        static constexpr std::size_t _huge_page_size = 2097152;
+
+        boost::mutex _lock;
+        boost::condition_variable _returned;
+        std::vector<uint8_t *> _free;
+        std::size_t _buffer_size;
+        std::size_t _limit;
+        std::size_t _allocated;
+        std::size_t _in_use;
+        bool _huge_pages;
+
+        uint8_t *_allocate()
+        {
+            void *mem = nullptr;
+#if __has_include(<sys/mman.h>)
+#if defined(MAP_HUGETLB)
+            if (_huge_pages)
+            {
+                mem = mmap(nullptr, _buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (mem == MAP_FAILED) mem = nullptr;
+            }
+#endif
+            if (mem == nullptr)
+            {
+                mem = mmap(nullptr, _buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (mem == MAP_FAILED) return nullptr;
+#if defined(MADV_HUGEPAGE)
+                if (_huge_pages) madvise(mem, _buffer_size, MADV_HUGEPAGE);
+#endif
+            }
+#elif defined(_MSC_VER)
+            mem = _aligned_malloc(_buffer_size, _page_size);
+#else
+            mem = std::aligned_alloc(_page_size, _buffer_size);
+#endif
+            return static_cast<uint8_t *>(mem);
+        }
+
+        void _deallocate(uint8_t *buffer) noexcept
+        {
+#if __has_include(<sys/mman.h>)
+            munmap(buffer, _buffer_size);
+#elif defined(_MSC_VER)
+            _aligned_free(buffer);
+#else
+            std::free(buffer);
+#endif
+        }
+
+        // Must be called with the lock held, returns nullptr if the limit has been reached.
+        uint8_t *_take()
+        {
+            if (!_free.empty())
+            {
+                auto buffer = _free.back();
+                _free.pop_back();
+                _in_use++;
+                return buffer;
+            }
+            if ((_allocated + 1) * _buffer_size > _limit) return nullptr;
+            auto buffer = _allocate();
+            if (buffer == nullptr) return nullptr;
+            _allocated++;
+            _in_use++;
+            return buffer;
+        }
+
+        void _give(uint8_t *buffer) noexcept
+        {
+            {
+                boost::lock_guard<boost::mutex> guard(_lock);
+                _free.push_back(buffer);
+                _in_use--;
+            }
+            _returned.notify_one();
+        }
+
+    public:
+
+        /**********************************************************************************************//**
+         * @class	lease buffer_pool.hpp
+         *
+         * @brief	A buffer borrowed from a pool, it is returned when the lease is destroyed or reset.
+         **************************************************************************************************/
+
+        class lease
+        {
+        private:
+            buffer_pool *_pool;
+            uint8_t *_buffer;
+
+            friend class buffer_pool;
+
+            lease(buffer_pool *pool, uint8_t *buffer) noexcept : _pool(pool), _buffer(buffer)
+            {
+
+            }
+
+        public:
+            lease() noexcept : _pool(nullptr), _buffer(nullptr)
+            {
+
+            }
+
+            lease(const lease&) = delete;
+
+            lease& operator=(const lease&) = delete;
+
+            lease(lease&& other) noexcept : _pool(other._pool), _buffer(other._buffer)
+            {
+                other._pool = nullptr;
+                other._buffer = nullptr;
+            }
+
+            lease& operator=(lease&& other) noexcept
+            {
+                if (this != &other)
+                {
+                    reset();
+                    _pool = other._pool;
+                    _buffer = other._buffer;
+                    other._pool = nullptr;
+                    other._buffer = nullptr;
+                }
+
+                return *this;
+            }
+
+            ~lease()
+            {
+                reset();
+            }
+
+            void reset() noexcept
+            {
+                if (_buffer != nullptr) _pool->_give(_buffer);
+                _pool = nullptr;
+                _buffer = nullptr;
+            }
+
+            [[nodiscard]] uint8_t *data() const noexcept
+            {
+                return _buffer;
+            }
+
+            [[nodiscard]] std::size_t size() const noexcept
+            {
+                return (_pool == nullptr) ? 0 : _pool->_buffer_size;
+            }
+
+            explicit operator bool() const noexcept
+            {
+                return (_buffer != nullptr);
+            }
+        };
+
+        /**********************************************************************************************//**
+         * @fn	buffer_pool::buffer_pool(std::size_t buffer_size, std::size_t limit, bool huge_pages = false)
+         *
+         * @brief	Creates an empty pool.
+         *
+         * @param 	buffer_size	The size of each buffer, in bytes. It is rounded up to a whole number of
+         * 						pages, or of huge pages when \p huge_pages is true.
+         * @param 	limit	   	The most memory all of the buffers together may occupy, in bytes. The
+         * 						pool always allows at least one buffer.
+         * @param 	huge_pages 	(Optional) True to back the buffers with huge pages where possible.
+         **************************************************************************************************/
+
+        buffer_pool(std::size_t buffer_size, std::size_t limit, bool huge_pages = false)
+        {
+            std::size_t unit = huge_pages ? _huge_page_size : _page_size;
+            if (buffer_size == 0) buffer_size = 1;
+            _buffer_size = ((buffer_size + unit - 1) / unit) * unit;
+            _limit = (limit < _buffer_size) ? _buffer_size : limit;
+            _allocated = 0;
+            _in_use = 0;
+            _huge_pages = huge_pages;
+        }
+
+        buffer_pool(const buffer_pool&) = delete;
+
+        buffer_pool& operator=(const buffer_pool&) = delete;
+
+        ~buffer_pool()
+        {
+            for (auto buffer : _free)
+            {
+                _deallocate(buffer);
+            }
+        }
+
+        [[nodiscard]] std::size_t buffer_size() const noexcept
+        {
+            return _buffer_size;
+        }
+
+        [[nodiscard]] std::size_t limit() const noexcept
+        {
+            return _limit;
+        }
+
+        /**********************************************************************************************//**
+         * @fn	lease buffer_pool::acquire()
+         *
+         * @brief	Borrows a buffer, blocking while the pool is at its limit.
+         *
+         * 			A thread must not block in acquire() while it holds other leases from the same pool,
+         * 			or every buffer may end up waiting on another; use try_acquire() for any buffer after
+         * 			the first.
+         *
+         * @exception	std::bad_alloc	Thrown if the system cannot provide memory for a buffer and no
+         * 								buffer is lent out that could be returned instead.
+         **************************************************************************************************/
+
+        lease acquire()
+        {
+            boost::unique_lock<boost::mutex> guard(_lock);
+            for (;;)
+            {
+                auto buffer = _take();
+                if (buffer != nullptr) return lease(this, buffer);
+                if (_in_use == 0) throw std::bad_alloc();
+                _returned.wait(guard);
+            }
+        }
+
+        /**********************************************************************************************//**
+         * @fn	lease buffer_pool::try_acquire()
+         *
+         * @brief	Borrows a buffer if one is available without waiting.
+         *
+         * @returns	The lease, which is empty if the pool is at its limit.
+         **************************************************************************************************/
+
+        lease try_acquire()
+        {
+            boost::lock_guard<boost::mutex> guard(_lock);
+            auto buffer = _take();
+            return (buffer == nullptr) ? lease() : lease(this, buffer);
+        }
+
+        // Gives the memory of every buffer that is not lent out back to the system, the pool grows again on demand.
+        void trim() noexcept
+        {
+            boost::lock_guard<boost::mutex> guard(_lock);
+            for (auto buffer : _free)
+            {
+                _deallocate(buffer);
+            }
+            _allocated -= _free.size();
+            _free.clear();
+        }
+    };
+}
+
+#endif //_BUFFER_POOL_HPP_
@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <vector>
+#include "digest_key.hpp"
+#include "path_store.hpp"
+
+#ifndef _DIGEST_INDEX_HPP_
+#define _DIGEST_INDEX_HPP_
+
+namespace oasis::filesystem
+{
+    /**********************************************************************************************//**
+     * @class	digest_index digest_index.hpp
+     *
+     * @brief	The sets of files found to share a digest, held in flat arrays.
+     *
+     * 			The sets are records in blocks of a deque and are found by their keys through an open
+     * 			addressing table of 32 bit indices, so adding a file costs a hash, a probe or two and
+     * 			no allocation of its own. The members of every set are path_store ids in one shared
+     * 			pool. A set that outgrows its room in the pool moves to the end of it with twice the
+     * 			room, leaving a gap behind.
+     *
+     * 			finish() closes the gaps: it lays the sets out in key order with their members packed
+     * 			one set after another, and has the members of any set that changed put in order. It is
+     * 			meant to be called once, when the sets are complete. Until then the sets are in the
+     * 			order they were found and may include erased ones, which have no members.
+     *
+     * 			The index is not synchronised.
+     **************************************************************************************************/
+
+    class digest_index
+    {
+    public:
+        using id_type = path_store::id_type;
+        using size_type = std::size_t;
+
+        // A set of files, its members are found with members().
+        struct set_type
+        {
+            digest_key key;
+            uint32_t offset;
+            uint32_t size;
+            uint32_t capacity;
+            bool sorted;
+        };
+
+        using const_iterator = std::deque<set_type>::const_iterator;
+        using const_reverse_iterator = std::deque<set_type>::const_reverse_iterator;
+
+    private:
+        static constexpr uint32_t _empty = std::numeric_limits<uint32_t>::max();
+        static constexpr uint32_t _erased = _empty - 1;
+
+        // A deque never copies the records to grow, which with tens of millions of sets would need the memory twice over.
+        std::deque<set_type> _sets;
+        std::vector<id_type> _members;
+        std::vector<uint32_t> _slots;
+        std::size_t _used_slots = 0;
+        std::size_t _live = 0;
+
+        void _rehash(std::size_t slot_count)
+        {
+            std::vector<uint32_t> slots(slot_count, _empty);
+            for (uint32_t s = 0; s < _sets.size(); s++)
+            {
+                if (_sets[s].size == 0) continue;
+                auto i = _sets[s].key.hash() & (slot_count - 1);
+                while (slots[i] != _empty) i = (i + 1) & (slot_count - 1);
+                slots[i] = s;
+            }
+            _slots.swap(slots);
+            _used_slots = _live;
+        }
+
+    public:
+        digest_index() = default;
+
+        [[nodiscard]] const_iterator begin() const noexcept
+        {
+            return _sets.begin();
+        }
+
+        [[nodiscard]] const_iterator end() const noexcept
+        {
+            return _sets.end();
+        }
+
+        [[nodiscard]] const_reverse_iterator rbegin() const noexcept
+        {
+            return _sets.rbegin();
+        }
+
+        [[nodiscard]] const_reverse_iterator rend() const noexcept
+        {
+            return _sets.rend();
+        }
+
+        // The number of sets that have not been erased.
+        [[nodiscard]] size_type size() const noexcept
+        {
+            return _live;
+        }
+
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return (_live == 0);
+        }
+
+        [[nodiscard]] const set_type& operator[](uint32_t set) const noexcept
+        {
+            return _sets[set];
+        }
+
+        [[nodiscard]] std::span<const id_type> members(const set_type& set) const noexcept
+        {
+            return std::span<const id_type>(_members.data() + set.offset, set.size);
+        }
+
+        [[nodiscard]] std::span<const id_type> members(uint32_t set) const noexcept
+        {
+            return members(_sets[set]);
+        }
+
+        /**********************************************************************************************//**
+         * @fn	uint32_t digest_index::find_or_add(const digest_key& key)
+         *
+         * @brief	Finds the set with the given key, adding an empty one if there is none.
+         *
+         * @returns	The index of the set, which stays valid until finish() or clear() is called.
+         *
+         * @exception	std::length_error	Thrown if the index cannot hold another set.
+         **************************************************************************************************/
+
+        uint32_t find_or_add(const digest_key& key)
+        {
+            // The table is kept at most 3/4 full, erased slots included, so a search always ends at an empty slot.
+            if ((_used_slots + 1) * 4 > _slots.size() * 3) _rehash(((_live + 1) * 2 > _slots.size()) ? std::max<std::size_t>(_slots.size() * 2, 1024) : _slots.size());
+
+            auto mask = _slots.size() - 1;
+            auto i = key.hash() & mask;
+            std::size_t reuse = _slots.size();
+            for (; _slots[i] != _empty; i = (i + 1) & mask)
+            {
+                if (_slots[i] == _erased)
+                {
+                    if (reuse == _slots.size()) reuse = i;
+                    continue;
+                }
+                if (_sets[_slots[i]].key == key) return _slots[i];
+            }
+
+            if (_sets.size() >= _erased) throw std::length_error("Too many sets");
+            auto set = static_cast<uint32_t>(_sets.size());
+            _sets.push_back({ key, static_cast<uint32_t>(0), 0, 0, true });
+            if (reuse != _slots.size())
+            {
+                _slots[reuse] = set;
+            }
+            else
+            {
+                _slots[i] = set;
+                _used_slots++;
+            }
+            _live++;
+            return set;
+        }
+
+        /**********************************************************************************************//**
+         * @fn	bool digest_index::insert(uint32_t set, id_type id, bool known)
+         *
+         * @brief	Adds a file to a set.
+         *
+         * @param 	set  	The index of the set.
+         * @param 	id   	The id of the file.
+         * @param 	known	False if the id is new, so it cannot be in the set yet and is not looked for.
+         *
+         * @returns	True if the file was added, false if it was already in the set.
+         *
+         * @exception	std::length_error	Thrown if the pool of members cannot grow any further.
+         **************************************************************************************************/
+
+        bool insert(uint32_t set, id_type id, bool known)
+        {
+            auto& s = _sets[set];
+            if (known && (std::find(_members.begin() + s.offset, _members.begin() + s.offset + s.size, id) != _members.begin() + s.offset + s.size)) return false;
+
+            if (s.size == s.capacity)
+            {
+                std::size_t capacity = (s.capacity == 0) ? 2 : (static_cast<std::size_t>(s.capacity) * 2);
+                if (_members.size() + capacity > std::numeric_limits<uint32_t>::max()) throw std::length_error("Too many members");
+                auto offset = _members.size();
+                _members.resize(offset + capacity);
+                std::copy(_members.begin() + s.offset, _members.begin() + s.offset + s.size, _members.begin() + offset);
+                s.offset = static_cast<uint32_t>(offset);
+                s.capacity = static_cast<uint32_t>(capacity);
+            }
+            _members[s.offset + s.size] = id;
+            s.size++;
+            s.sorted = (s.size == 1);
+
+            return true;
+        }
+
+        // Removes every set the predicate is true of, the predicate is called once for every set that has not been erased.
+        template<typename PredT>
+        void erase_if(PredT pred)
+        {
+            for (uint32_t set = 0; set < _sets.size(); set++)
+            {
+                auto& s = _sets[set];
+                if ((s.size == 0) || !pred(static_cast<const set_type&>(s))) continue;
+
+                auto mask = _slots.size() - 1;
+                auto i = s.key.hash() & mask;
+                while (_slots[i] != set) i = (i + 1) & mask;
+                _slots[i] = _erased;
+                s.size = 0;
+                s.capacity = 0;
+                _live--;
+            }
+        }
+
+        /**********************************************************************************************//**
+         * @fn	template<typename SortT> void digest_index::finish(SortT sort)
+         *
+         * @brief	Packs the sets that have not been erased into key order, with their members one set
+         * 			after another and no room to spare.
+         *
+         * @tparam	SortT	A callable taking <tt>(id_type *first, std::size_t count)</tt>.
+         * @param 	sort 	Called to put the members of each set in order, for the sets that have
+         * 					gained members since they were last put in order.
+         **************************************************************************************************/
+
+        template<typename SortT>
+        void finish(SortT sort)
+        {
+            // The records are sorted where they are, only the members are copied, into a pool of exactly their size.
+            _sets.erase(std::remove_if(_sets.begin(), _sets.end(), [](const set_type& s) { return (s.size == 0); }), _sets.end());
+            std::sort(_sets.begin(), _sets.end(), [](const set_type& lhs, const set_type& rhs) { return lhs.key < rhs.key; });
+
+            std::size_t total = 0;
+            for (const auto& s : _sets)
+            {
+                total += s.size;
+            }
+            std::vector<id_type> members;
+            members.reserve(total);
+            for (auto& s : _sets)
+            {
+                auto offset = members.size();
+                members.insert(members.end(), _members.begin() + s.offset, _members.begin() + s.offset + s.size);
+                if (!s.sorted) sort(members.data() + offset, static_cast<std::size_t>(s.size));
+                s.offset = static_cast<uint32_t>(offset);
+                s.capacity = s.size;
+                s.sorted = true;
+            }
+            _members.swap(members);
+
+            std::size_t slot_count = 1024;
+            while (slot_count * 3 < (_live + 1) * 4) slot_count *= 2;
+            _rehash(slot_count);
+        }
+
+        // Replaces every member of the sets that have not been erased with the id the function gives for it, visiting
+        // them in the order the sets and their members are iterated.
+        template<typename FuncT>
+        void remap(FuncT func)
+        {
+            for (const auto& s : _sets)
+            {
+                for (auto i = s.offset; i < s.offset + s.size; i++)
+                {
+                    _members[i] = func(_members[i]);
+                }
+            }
+        }
+
+        // The memory taken by the index, in bytes.
+        [[nodiscard]] std::size_t memory_used() const noexcept
+        {
+            return (_sets.size() * sizeof(set_type)) + (_members.capacity() * sizeof(id_type)) + (_slots.capacity() * sizeof(uint32_t));
+        }
+
+        void clear() noexcept
+        {
+            std::deque<set_type>().swap(_sets);
+            std::vector<id_type>().swap(_members);
+            std::vector<uint32_t>().swap(_slots);
+            _used_slots = 0;
+            _live = 0;
+        }
+    };
+}
+
+#endif //_DIGEST_INDEX_HPP_
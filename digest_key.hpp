@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include "foundation.hpp"
+
+#ifndef _DIGEST_KEY_HPP_
+#define _DIGEST_KEY_HPP_
+
+namespace oasis::filesystem
+{
+    /**********************************************************************************************//**
+     * @class	digest_key digest_key.hpp
+     *
+     * @brief	A fixed width, binary key identifying the content of a file: the size of the file
+     * 			followed by up to 64 bytes of digest.
+     *
+     * 			The key is trivially copyable and never allocates, comparisons look at the size, the
+     * 			digest length and then the digest bytes. A human readable form is only produced when
+     * 			to_string() is called, it has the form <tt>size:HEXDIGEST</tt> and is accepted by
+     * 			from_string().
+     **************************************************************************************************/
+
+    class digest_key
+    {
+    public:
+        static constexpr std::size_t capacity = 64;
+
+    private:
+        uintmax_t _size;
+        uint8_t _length;
+        uint8_t _bytes[capacity];
+
+        static int _from_hex(int ch) noexcept
+        {
+            if ((ch >= '0') && (ch <= '9')) return ch - '0';
+            if ((ch >= 'a') && (ch <= 'f')) return ch - 'a' + 10;
+            if ((ch >= 'A') && (ch <= 'F')) return ch - 'A' + 10;
+            return -1;
+        }
+
+    public:
+        digest_key() noexcept : _size(0), _length(0), _bytes{}
+        {
+
+        }
+
+        /**********************************************************************************************//**
+         * @fn	digest_key::digest_key(uintmax_t size, const uint8_t *data, std::size_t length)
+         *
+         * @brief	Creates a key for a file of the given size from a digest.
+         *
+         * @exception	std::invalid_argument	Thrown if \p length is larger than \c capacity.
+         *
+         * @param 	size  	The size of the file, in bytes.
+         * @param 	data  	The digest bytes, may be \c nullptr if \p length is zero.
+         * @param 	length	The number of bytes in the digest.
+         **************************************************************************************************/
+
+        digest_key(uintmax_t size, const uint8_t *data, std::size_t length) : _size(size), _bytes{}
+        {
+            if (length > capacity) throw std::invalid_argument("The digest is too long");
+            _length = static_cast<uint8_t>(length);
+            if (length != 0) std::memcpy(_bytes, data, length);
+        }
+
+        [[nodiscard]] uintmax_t file_size() const noexcept
+        {
+            return _size;
+        }
+
+        [[nodiscard]] const uint8_t *data() const noexcept
+        {
+            return _bytes;
+        }
+
+        [[nodiscard]] std::size_t length() const noexcept
+        {
+            return _length;
+        }
+
+        [[nodiscard]] int compare(const digest_key& other) const noexcept
+        {
+            if (_size != other._size) return (_size < other._size) ? -1 : 1;
+            if (_length != other._length) return (_length < other._length) ? -1 : 1;
+            return std::memcmp(_bytes, other._bytes, _length);
+        }
+
+        /**********************************************************************************************//**
+         * @fn	std::size_t digest_key::hash() const noexcept
+         *
+         * @brief	Gets a hash value for this key, suitable for unordered containers.
+         *
+         * @returns	A hash value combining the file size with every byte of the digest.
+         **************************************************************************************************/
+
+        [[nodiscard]] std::size_t hash() const noexcept
+        {
+            uint64_t h = 0xcbf29ce484222325ULL ^ static_cast<uint64_t>(_size);
+            std::size_t i = 0;
+            for (; i + sizeof(uint64_t) <= _length; i += sizeof(uint64_t))
+            {
+                uint64_t w;
+                std::memcpy(&w, _bytes + i, sizeof(w));
+                h = (h ^ w) * 0x100000001b3ULL;
+                h ^= h >> 29;
+            }
+            for (; i < _length; i++)
+            {
+                h = (h ^ _bytes[i]) * 0x100000001b3ULL;
+            }
+            h ^= _length;
+            h ^= h >> 32;
+
+            return static_cast<std::size_t>(h);
+        }
+
+        /**********************************************************************************************//**
+         * @fn	std::string digest_key::to_string() const
+         *
+         * @brief	Renders this key in the form <tt>size:HEXDIGEST</tt>.
+         **************************************************************************************************/
+
+        [[nodiscard]] std::string to_string() const
+        {
+            static const char digits[] = "0123456789ABCDEF";
+            std::string out = std::to_string(_size);
+            out.reserve(out.size() + 1 + (_length * 2));
+            out.push_back(':');
+            for (std::size_t i = 0; i < _length; i++)
+            {
+                out.push_back(digits[_bytes[i] >> 4]);
+                out.push_back(digits[_bytes[i] & 0x0F]);
+            }
+
+            return out;
+        }
+
+        /**********************************************************************************************//**
+         * @fn	template<typename StringT> static digest_key digest_key::from_string(const StringT& str)
+         *
+         * @brief	Parses a key previously rendered by to_string().
+         *
+         * @exception	std::invalid_argument	Thrown if \p str is not a valid key string.
+         *
+         * @tparam	StringT	An array of ASCII characters, of a type convertible to <tt>char</tt> or a
+         * 					string type that satisfies the C++ named requirement: <em>Container</em>.
+         * @param 	str	The string to parse.
+         *
+         * @returns	The parsed key.
+         **************************************************************************************************/
+
+        template<typename StringT>
+        static digest_key from_string(const StringT& str)
+        {
+            std::string s;
+            if constexpr (std::is_pointer<StringT>::value || std::is_array<StringT>::value)
+            {
+                for (std::size_t idx = 0; str[idx] != 0; idx++)
+                {
+                    s.push_back(static_cast<std::string::value_type>(str[idx] & 0xFF));
+                }
+            }
+            else
+            {
+                std::transform(str.begin(), str.end(), std::back_inserter(s), [](auto ch) { return static_cast<std::string::value_type>(ch & 0xFF); });
+            }
+
+            auto sep = s.find(':');
+            if ((sep == 0) || (sep == std::string::npos)) throw std::invalid_argument("Invalid hash string");
+            std::string_view size_part(s.data(), sep);
+            std::string_view hex_part(s.data() + sep + 1, s.size() - sep - 1);
+            if (!are_arabic_numerals(size_part)) throw std::invalid_argument("Invalid hash string");
+            if (((hex_part.size() % 2) != 0) || ((hex_part.size() / 2) > capacity)) throw std::invalid_argument("Invalid hash string");
+
+            digest_key key;
+            key._size = std::stoull(std::string(size_part));
+            key._length = static_cast<uint8_t>(hex_part.size() / 2);
+            for (std::size_t i = 0; i < key._length; i++)
+            {
+                int hi = _from_hex(hex_part[i * 2]);
+                int lo = _from_hex(hex_part[(i * 2) + 1]);
+                if ((hi < 0) || (lo < 0)) throw std::invalid_argument("Invalid hash string");
+                key._bytes[i] = static_cast<uint8_t>((hi << 4) | lo);
+            }
+
+            return key;
+        }
+    };
+
+    static_assert(std::is_trivially_copyable<digest_key>::value, "digest_key must be trivially copyable");
+
+    inline bool operator==(const digest_key& lhs, const digest_key& rhs) noexcept
+    {
+        return (lhs.compare(rhs) == 0);
+    }
+
+    inline bool operator!=(const digest_key& lhs, const digest_key& rhs) noexcept
+    {
+        return (lhs.compare(rhs) != 0);
+    }
+
+    inline bool operator<(const digest_key& lhs, const digest_key& rhs) noexcept
+    {
+        return (lhs.compare(rhs) < 0);
+    }
+
+    inline bool operator>(const digest_key& lhs, const digest_key& rhs) noexcept
+    {
+        return (lhs.compare(rhs) > 0);
+    }
+
+    inline bool operator<=(const digest_key& lhs, const digest_key& rhs) noexcept
+    {
+        return (lhs.compare(rhs) <= 0);
+    }
+
+    inline bool operator>=(const digest_key& lhs, const digest_key& rhs) noexcept
+    {
+        return (lhs.compare(rhs) >= 0);
+    }
+}
+
+template<>
+struct std::hash<oasis::filesystem::digest_key>
+{
+    std::size_t operator()(const oasis::filesystem::digest_key& key) const noexcept
+    {
+        return key.hash();
+    }
+};
+
+#endif //_DIGEST_KEY_HPP_
@@ -1,7 +1,18 @@
 #include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
 #include <cerrno>
-#if defined(__GNUC__) || defined(__clang__) || defined(__MINGW32__) || defined(__MINGW64__)
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#if defined(__linux__)
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__GNUC__) || defined(__clang__) || defined(__MINGW32__) || defined(__MINGW64__)
+#include <dirent.h>
+#include <unistd.h>
 #elif defined(_MSC_VER)
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN 
@@ -16,6 +27,181 @@
 
 namespace oasis::filesystem
 {
+    // What a directory entry is, as far as the directory itself tells. Some file systems do not record it, the
+    // entry then has to be examined to find out.
+    enum class entry_type : uint8_t
+    {
+        unknown,
+        file,
+        directory,
+        symlink,
+        other,
+    };
+
+    /**********************************************************************************************//**
+     * @class	directory_handle directory_enumerator.hpp
+     *
+     * @brief	A directory found by a walk, held open where the system allows it so its entries can be
+     * 			examined and its sub-directories opened by their names rather than by paths resolved
+     * 			from the root. The descriptor is closed when the last reference to the handle goes.
+     **************************************************************************************************/
+
+    class directory_handle
+    {
+    private:
+        boost::filesystem::path _path;
+        int _fd;
+
+    public:
+        // Takes ownership of the descriptor, which may be -1 for a directory that is known only by its path.
+        directory_handle(boost::filesystem::path p, int fd) noexcept : _path(std::move(p)), _fd(fd)
+        {
+        }
+
+        directory_handle(const directory_handle&) = delete;
+
+        directory_handle& operator=(const directory_handle&) = delete;
+
+        ~directory_handle()
+        {
+#if !defined(_MSC_VER)
+            if (_fd >= 0) ::close(_fd);
+#endif
+        }
+
+        [[nodiscard]] const boost::filesystem::path& path() const noexcept
+        {
+            return _path;
+        }
+
+        [[nodiscard]] int fd() const noexcept
+        {
+            return _fd;
+        }
+    };
+
+    /**********************************************************************************************//**
+     * @class	directory_entry directory_enumerator.hpp
+     *
+     * @brief	An entry of a directory as the enumerator found it: its name, the directory it is in,
+     * 			and the type and inode the directory recorded for it.
+     *
+     * 			The full path is only built when it is asked for. The status of the entry is looked up
+     * 			the first time it is asked for, relative to the open directory where there is one, and
+     * 			kept, so a file is examined once however many stages need its size or times. Links are
+     * 			not followed. An entry may be moved between threads, but must not be used by several
+     * 			at once.
+     **************************************************************************************************/
+
+    class directory_entry
+    {
+    public:
+        using name_type = std::basic_string_view<boost::filesystem::path::value_type>;
+
+    private:
+        std::shared_ptr<const directory_handle> _parent;
+        boost::filesystem::path::string_type _name;
+        mutable entry_type _type;
+        uintmax_t _inode;
+        mutable entry_status _status;
+
+    public:
+        directory_entry() noexcept : _type(entry_type::unknown), _inode(0)
+        {
+        }
+
+        directory_entry(std::shared_ptr<const directory_handle> parent, name_type name, entry_type type = entry_type::unknown, uintmax_t inode = 0) : _parent(std::move(parent)), _name(name), _type(type), _inode(inode)
+        {
+        }
+
+        [[nodiscard]] const boost::filesystem::path::string_type& name() const noexcept
+        {
+            return _name;
+        }
+
+        [[nodiscard]] const std::shared_ptr<const directory_handle>& parent() const noexcept
+        {
+            return _parent;
+        }
+
+        // The type recorded in the directory, or found by status() when the directory did not record one.
+        [[nodiscard]] entry_type type() const noexcept
+        {
+            return _type;
+        }
+
+        // The inode recorded in the directory, or zero where the system does not provide it.
+        [[nodiscard]] uintmax_t inode() const noexcept
+        {
+            return _inode;
+        }
+
+        // Whether the name marks the entry as hidden on systems other than Windows.
+        [[nodiscard]] bool dot_file() const noexcept
+        {
+            return !_name.empty() && (_name[0] == '.');
+        }
+
+        // The path of the entry, built in one allocation.
+        [[nodiscard]] boost::filesystem::path path() const
+        {
+            const auto& dir = _parent->path().native();
+            boost::filesystem::path::string_type p;
+            p.reserve(dir.size() + _name.size() + 1);
+            p = dir;
+            if (p.empty() || (p.back() != boost::filesystem::path::preferred_separator)) p += boost::filesystem::path::preferred_separator;
+            p += _name;
+            return boost::filesystem::path(std::move(p));
+        }
+
+        // Whether status() has already been looked up.
+        [[nodiscard]] bool has_status() const noexcept
+        {
+            return _status.valid;
+        }
+
+        /**********************************************************************************************//**
+         * @fn	const entry_status& directory_entry::status(boost::system::error_code& ec) const noexcept
+         *
+         * @brief	Gets the identity, size, times and mode of the entry, looking them up the first time.
+         *
+         * @param [out]	ec	Receives the error if the entry cannot be examined.
+         *
+         * @returns	The status, which is not valid if the entry could not be examined. The mode is only
+         * 			filled in on systems other than Windows.
+         **************************************************************************************************/
+
+        const entry_status& status(boost::system::error_code& ec) const noexcept
+        {
+            ec.clear();
+            if (_status.valid) return _status;
+
+#if defined(_MSC_VER)
+            _status.id = identity(path(), _status.size, _status.times, ec);
+            _status.valid = !ec;
+#else
+            if (_parent->fd() >= 0)
+            {
+                status_at(_parent->fd(), _name.c_str(), _status, ec);
+            }
+            else
+            {
+                auto p = path();
+                status_at(AT_FDCWD, p.c_str(), _status, ec);
+            }
+            if (_status.valid && (_type == entry_type::unknown))
+            {
+                if (S_ISREG(_status.mode)) _type = entry_type::file;
+                else if (S_ISDIR(_status.mode)) _type = entry_type::directory;
+                else if (S_ISLNK(_status.mode)) _type = entry_type::symlink;
+                else _type = entry_type::other;
+            }
+#endif
+
+            return _status;
+        }
+    };
+
     /**********************************************************************************************//**
      * @class	directory_enumerator directory_enumerator.hpp
      *
@@ -26,20 +212,62 @@ namespace oasis::filesystem
      * 			
      * 			This class does not search recursively and will return all files and directories
      * 			found, with the exception of the special entries '.' and '..'
+     *
+     * 			The name, type and inode of the current entry are also available without building a
+     * 			path, or together as a directory_entry from entry(). On Linux the entries are read in
+     * 			large batches with getdents64 into a buffer that is kept for the next enumerator
+     * 			created on the same thread, so enumerating a directory allocates nothing once that
+     * 			buffer exists.
      **************************************************************************************************/
 
     class directory_enumerator
     {
+    public:
+        using name_type = std::basic_string_view<boost::filesystem::path::value_type>;
+
     private:
         boost::filesystem::path _search_dir;
+        std::shared_ptr<const directory_handle> _parent;
         bool _opened;
-        boost::filesystem::path _current;
         bool _ended;
-#if defined(__GNUC__) || defined(__clang__) || defined(__MINGW32__) || defined(__MINGW64__)
+        name_type _name;
+        entry_type _type;
+        uintmax_t _inode;
+#if defined(__linux__)
+        static constexpr std::size_t _batch_size = 262144;
+
+        int _fd;
+        std::unique_ptr<char[]> _batch;
+        std::size_t _filled;
+        std::size_t _offset;
+
+        // The batch buffer of the last enumerator that finished on this thread, waiting for the next one.
+        static std::unique_ptr<char[]>& _spare() noexcept
+        {
+            thread_local std::unique_ptr<char[]> spare;
+            return spare;
+        }
+
+        // The descriptor belongs to the handle, which entries may still hold.
+        void _close() noexcept
+        {
+            _parent.reset();
+            _fd = -1;
+            if (_batch && !_spare()) _spare() = std::move(_batch);
+            _batch.reset();
+        }
+#elif defined(__GNUC__) || defined(__clang__) || defined(__MINGW32__) || defined(__MINGW64__)
         DIR* _pdir;
 #elif defined(_MSC_VER)
         WIN32_FIND_DATA _fdFileData;
         HANDLE _hFind;
+
+        entry_type _find_data_type() const noexcept
+        {
+            if (_fdFileData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) return entry_type::symlink;
+            if (_fdFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) return entry_type::directory;
+            return entry_type::file;
+        }
 #endif
         
     public:
@@ -67,17 +295,58 @@ namespace oasis::filesystem
             if (!boost::filesystem::is_directory(_search_dir)) throw std::invalid_argument("Search path is not a directory");
             _opened = false;
             _ended = true;
-#if defined(__GNUC__) || defined(__clang__) || defined(__MINGW32__) || defined(__MINGW64__)
+            _type = entry_type::unknown;
+            _inode = 0;
+#if defined(__linux__)
+            _fd = -1;
+            _filled = 0;
+            _offset = 0;
+#elif defined(__GNUC__) || defined(__clang__) || defined(__MINGW32__) || defined(__MINGW64__)
             _pdir = nullptr;
+            _parent = std::make_shared<const directory_handle>(_search_dir, -1);
 #elif defined(_MSC_VER)
             _hFind = INVALID_HANDLE_VALUE;
+            _parent = std::make_shared<const directory_handle>(_search_dir, -1);
 #endif
             
         }
 
+#if defined(__linux__)
+
+        /**********************************************************************************************//**
+         * @fn	explicit directory_enumerator::directory_enumerator(std::shared_ptr<const directory_handle> dir) noexcept
+         *
+         * @brief	Creates an enumerator for a directory the caller has already opened, so it can be
+         * 			opened relative to its parent rather than by a path resolved from the root.
+         *
+         * @param 	dir	The open directory, with its canonical path. The entries are read from the
+         * 				current position of its descriptor.
+         **************************************************************************************************/
+
+        explicit directory_enumerator(std::shared_ptr<const directory_handle> dir) noexcept
+        {
+            _search_dir = dir->path();
+            _fd = dir->fd();
+            _parent = std::move(dir);
+            _opened = false;
+            _ended = true;
+            _type = entry_type::unknown;
+            _inode = 0;
+            _filled = 0;
+            _offset = 0;
+        }
+
+#endif
+
+        directory_enumerator(const directory_enumerator&) = delete;
+
+        directory_enumerator& operator=(const directory_enumerator&) = delete;
+
         ~directory_enumerator()
         {
-#if defined(__GNUC__) || defined(__clang__) || defined(__MINGW32__) || defined(__MINGW64__)
+#if defined(__linux__)
+            _close();
+#elif defined(__GNUC__) || defined(__clang__) || defined(__MINGW32__) || defined(__MINGW64__)
             if (_pdir != nullptr) closedir(_pdir);
 #elif defined(_MSC_VER)
             if (_hFind != INVALID_HANDLE_VALUE) FindClose(_hFind);
@@ -115,11 +384,162 @@ namespace oasis::filesystem
         boost::filesystem::path current()
         {
             if (!_opened || _ended) throw std::system_error(EINVAL, std::generic_category());
-            return _current;
+            // Built in one allocation, as a directory may hold millions of entries.
+            const auto& dir = _search_dir.native();
+            boost::filesystem::path::string_type p;
+            p.reserve(dir.size() + _name.size() + 1);
+            p = dir;
+            if (p.empty() || (p.back() != boost::filesystem::path::preferred_separator)) p += boost::filesystem::path::preferred_separator;
+            p += _name;
+            return boost::filesystem::path(std::move(p));
+        }
+
+        // The directory being enumerated, as a canonical path.
+        [[nodiscard]] const boost::filesystem::path& directory() const noexcept
+        {
+            return _search_dir;
+        }
+
+        // The name of the current entry. It is followed by a null character, and stays valid until the next call to
+        // move_next().
+        [[nodiscard]] name_type name() const noexcept
+        {
+            return _name;
+        }
+
+        // The type of the current entry as recorded in the directory, symbolic links are not followed.
+        [[nodiscard]] entry_type type() const noexcept
+        {
+            return _type;
+        }
+
+        // The inode of the current entry, or zero where the system does not provide it.
+        [[nodiscard]] uintmax_t inode() const noexcept
+        {
+            return _inode;
+        }
+
+        /**********************************************************************************************//**
+         * @fn	directory_entry directory_enumerator::entry() const
+         *
+         * @brief	Gets the entry at the current position of this enumerator, with what the directory
+         * 			recorded about it. The entry keeps the directory open, on systems where it is open,
+         * 			so the entry can be examined relative to it.
+         *
+         * @exception	std::system_error	Thrown if a call to this method has not been preceded by a
+         * 									successful call to \link move_next()\endlink.
+         **************************************************************************************************/
+
+        [[nodiscard]] directory_entry entry() const
+        {
+            if (!_opened || _ended) throw std::system_error(EINVAL, std::generic_category());
+            return directory_entry(_parent, _name, _type, _inode);
         }
     };
 
-#if defined(__GNUC__) || defined(__clang__) || defined(__MINGW32__) || defined(__MINGW64__)
+#if defined(__linux__)
+
+    bool directory_enumerator::move_next(boost::system::error_code& ec) noexcept
+    {
+        ec.clear();
+
+        if (!_opened)
+        {
+            while (!_parent)
+            {
+                _fd = ::open(_search_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (_fd >= 0)
+                {
+                    try
+                    {
+                        _parent = std::make_shared<const directory_handle>(_search_dir, _fd);
+                        break;
+                    }
+                    catch (const std::bad_alloc&)
+                    {
+                        ::close(_fd);
+                        _fd = -1;
+                        ec = boost::system::error_code(ENOMEM, boost::system::generic_category());
+                        return false;
+                    }
+                }
+                if ((errno == ENFILE) || (errno == EMFILE) || (errno == ENOSR) || (errno == EAGAIN) || (errno == ENOMEM))
+                {
+                    boost::this_thread::sleep_for(boost::chrono::seconds(5));
+                    continue;
+                }
+                else
+                {
+                    ec = boost::system::error_code(errno, boost::system::generic_category());
+                    return false;
+                }
+            }
+            _batch = std::move(_spare());
+            if (!_batch)
+            {
+                _batch.reset(new (std::nothrow) char[_batch_size]);
+                if (!_batch)
+                {
+                    _close();
+                    ec = boost::system::error_code(ENOMEM, boost::system::generic_category());
+                    return false;
+                }
+            }
+            _opened = true;
+        }
+        if (_fd < 0)
+        {
+            _ended = true;
+            return false;
+        }
+
+        // Each record of a batch is a struct linux_dirent64: the inode, an offset, the length of the record, the type
+        // and the name, which is null terminated and padded.
+        constexpr std::size_t reclen_at = 16, type_at = 18, name_at = 19;
+        for (;;)
+        {
+            if (_offset >= _filled)
+            {
+                auto n = ::syscall(SYS_getdents64, _fd, _batch.get(), _batch_size);
+                if (n <= 0)
+                {
+                    if ((n < 0) && (errno == EINTR)) continue;
+                    if (n < 0) ec = boost::system::error_code(errno, boost::system::generic_category());
+                    _ended = true;
+                    _close();
+                    return false;
+                }
+                _filled = static_cast<std::size_t>(n);
+                _offset = 0;
+            }
+
+            const char *record = _batch.get() + _offset;
+            uint16_t length = 0;
+            std::memcpy(&length, record + reclen_at, sizeof(length));
+            _offset += length;
+
+            const char *name = record + name_at;
+            if ((name[0] == '.') && ((name[1] == '\0') || ((name[1] == '.') && (name[2] == '\0')))) continue;
+
+            uint64_t inode = 0;
+            std::memcpy(&inode, record, sizeof(inode));
+            _inode = static_cast<uintmax_t>(inode);
+            _name = name_type(name);
+            switch (static_cast<unsigned char>(record[type_at]))
+            {
+                case DT_REG: _type = entry_type::file; break;
+                case DT_DIR: _type = entry_type::directory; break;
+                case DT_LNK: _type = entry_type::symlink; break;
+                case DT_UNKNOWN: _type = entry_type::unknown; break;
+                default: _type = entry_type::other; break;
+            }
+            _ended = false;
+
+            return true;
+        }
+    }
+
+#elif defined(__GNUC__) || defined(__clang__) || defined(__MINGW32__) || defined(__MINGW64__)
 
     bool directory_enumerator::move_next(boost::system::error_code& ec) noexcept
     {
@@ -145,11 +565,11 @@ namespace oasis::filesystem
             _opened = true;
         }
 
-        char *name = nullptr;
+        dirent *de = nullptr;
         for (;;)
         {
             errno = 0;
-            auto de = readdir(_pdir);
+            de = readdir(_pdir);
             if (de == nullptr)
             {
                 ec = boost::system::error_code(errno, boost::system::generic_category());
@@ -158,14 +578,24 @@ namespace oasis::filesystem
                 _pdir = nullptr;
                 return false;
             }
-            name = de->d_name;
-            if (std::strcmp(name, ".") == 0) continue;
-            if (std::strcmp(name, "..") == 0) continue;
+            if (std::strcmp(de->d_name, ".") == 0) continue;
+            if (std::strcmp(de->d_name, "..") == 0) continue;
             break;
         }
 
-        boost::filesystem::path out(name);
-        _current = _search_dir / out;
+        _name = name_type(de->d_name);
+        _inode = static_cast<uintmax_t>(de->d_ino);
+        _type = entry_type::unknown;
+#if defined(DT_DIR)
+        switch (de->d_type)
+        {
+            case DT_REG: _type = entry_type::file; break;
+            case DT_DIR: _type = entry_type::directory; break;
+            case DT_LNK: _type = entry_type::symlink; break;
+            case DT_UNKNOWN: break;
+            default: _type = entry_type::other; break;
+        }
+#endif
         _ended = false;
 
         return true;
@@ -196,10 +626,10 @@ namespace oasis::filesystem
                 {
                     _opened = true;
                     _ended = false;
-                    boost::filesystem::path out(_fdFileData.cFileName);
-                    if ((out.wstring() != L".") && (out.wstring() != L"..")) // Unlikely, but all eventualities must be accounted for.
+                    _name = name_type(_fdFileData.cFileName);
+                    if ((_name != L".") && (_name != L"..")) // Unlikely, but all eventualities must be accounted for.
                     {
-                        _current = _search_dir / out;
+                        _type = _find_data_type();
                         return true;
                     }
                     break;
@@ -211,9 +641,9 @@ namespace oasis::filesystem
         {
             if (FindNextFile(_hFind, &_fdFileData))
             {
-                boost::filesystem::path out(_fdFileData.cFileName);
-                if ((out.wstring() == L".") || (out.wstring() == L"..")) continue;
-                _current = _search_dir / out;
+                _name = name_type(_fdFileData.cFileName);
+                if ((_name == L".") || (_name == L"..")) continue;
+                _type = _find_data_type();
                 _ended = false;
                 return true;
             }
@@ -0,0 +1,347 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include "foundation.hpp"
+#if !defined (_MSC_VER)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifndef _DIRECTORY_SNAPSHOT_HPP_
+#define _DIRECTORY_SNAPSHOT_HPP_
+
+namespace oasis::filesystem
+{
+    /**********************************************************************************************//**
+     * @class	directory_snapshot directory_snapshot.hpp
+     *
+     * @brief	The entries of every directory found by a scan, with the identity and times the
+     * 			directory had when it was read, so a later scan can reuse the entries of a directory
+     * 			that has not changed instead of reading it again.
+     *
+     * 			Adding, removing or renaming an entry updates the modification and status change times
+     * 			of its directory, but writing to a file does not, so only the names and kinds of the
+     * 			entries are kept; the files themselves are still examined by every scan.
+     *
+     * 			A scan looks directories up in the listings loaded from the file while it records the
+     * 			listings it builds separately, commit() then makes those the current listings, which
+     * 			drops directories that no longer exist. find() may be called from several threads at
+     * 			once, and so may record(), but neither may overlap load(), commit() or merge().
+     *
+     * 			The file is written to a temporary file that is then renamed over the original, and
+     * 			ends with a checksum of its contents. A file that is missing, damaged or written by
+     * 			another version of this class is treated as an empty snapshot, which only costs the
+     * 			next scan the time to read every directory.
+     **************************************************************************************************/
+
+    class directory_snapshot
+    {
+    public:
+        enum class entry_kind : uint8_t
+        {
+            file = 1,
+            directory = 2,
+            other = 3,  // A symbolic link, or an entry that was skipped, it is examined again by the next scan.
+        };
+
+        struct entry
+        {
+            boost::filesystem::path name;
+            entry_kind kind;
+            bool hidden;
+        };
+
+        struct listing
+        {
+            boost::filesystem::path canonical;
+            file_identity id;
+            file_times times;
+            std::vector<entry> entries;
+        };
+
+    private:
+        static constexpr char _magic[8] = { 'O', 'A', 'S', 'I', 'S', 'D', 'S', '1' };
+        static constexpr uint32_t _version = 1;
+
+        using map_t = std::unordered_map<std::string, std::shared_ptr<const listing>>;
+
+        map_t _listings;
+        map_t _recorded;
+        boost::mutex _lock;
+
+        static std::string _key(const boost::filesystem::path& p)
+        {
+            const auto& native = p.native();
+            return std::string(reinterpret_cast<const char *>(native.data()), native.size() * sizeof(boost::filesystem::path::value_type));
+        }
+
+        static boost::filesystem::path _from_key(const std::string& key)
+        {
+            using char_t = boost::filesystem::path::value_type;
+            std::basic_string<char_t> native(key.size() / sizeof(char_t), char_t());
+            std::memcpy(native.data(), key.data(), native.size() * sizeof(char_t));
+            return boost::filesystem::path(native);
+        }
+
+        static uint64_t _checksum(const std::string& data) noexcept
+        {
+            uint64_t h = 0xcbf29ce484222325ULL;
+            for (auto ch : data)
+            {
+                h = (h ^ static_cast<uint8_t>(ch)) * 0x100000001b3ULL;
+            }
+
+            return h;
+        }
+
+        template <typename T>
+        static void _put(std::string& out, T value)
+        {
+            out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+
+        static void _put(std::string& out, const std::string& value)
+        {
+            _put(out, static_cast<uint32_t>(value.size()));
+            out.append(value);
+        }
+
+        template <typename T>
+        static bool _get(const std::string& in, std::size_t& offset, T& value)
+        {
+            if (in.size() - offset < sizeof(value)) return false;
+            std::memcpy(&value, in.data() + offset, sizeof(value));
+            offset += sizeof(value);
+            return true;
+        }
+
+        static bool _get(const std::string& in, std::size_t& offset, std::string& value)
+        {
+            uint32_t length = 0;
+            if (!_get(in, offset, length) || (in.size() - offset < length)) return false;
+            value.assign(in.data() + offset, length);
+            offset += length;
+            return true;
+        }
+
+        // Parses the body of a snapshot file, returns false if it is malformed.
+        bool _parse(const std::string& body)
+        {
+            std::size_t offset = 0;
+            uint64_t count = 0;
+            if (!_get(body, offset, count)) return false;
+            for (uint64_t i = 0; i < count; i++)
+            {
+                std::string dir, canonical;
+                auto l = std::make_shared<listing>();
+                uint64_t device = 0, inode = 0;
+                uint32_t entries = 0;
+                if (!_get(body, offset, dir) || !_get(body, offset, canonical)) return false;
+                if (!_get(body, offset, device) || !_get(body, offset, inode)) return false;
+                if (!_get(body, offset, l->times.modified) || !_get(body, offset, l->times.changed)) return false;
+                if (!_get(body, offset, entries)) return false;
+                l->canonical = _from_key(canonical);
+                l->id = file_identity{ device, inode };
+                l->entries.reserve(entries);
+                for (uint32_t j = 0; j < entries; j++)
+                {
+                    uint8_t kind = 0, hidden = 0;
+                    std::string name;
+                    if (!_get(body, offset, kind) || !_get(body, offset, hidden) || !_get(body, offset, name)) return false;
+                    if ((kind < 1) || (kind > 3)) return false;
+                    l->entries.push_back(entry{ _from_key(name), static_cast<entry_kind>(kind), hidden != 0 });
+                }
+                _listings[dir] = std::move(l);
+            }
+
+            return (offset == body.size());
+        }
+
+    public:
+        directory_snapshot() = default;
+
+        /**********************************************************************************************//**
+         * @fn	explicit directory_snapshot::directory_snapshot(const boost::filesystem::path& p)
+         *
+         * @brief	Loads the snapshot saved in a file, see load().
+         **************************************************************************************************/
+
+        explicit directory_snapshot(const boost::filesystem::path& p)
+        {
+            load(p);
+        }
+
+        directory_snapshot(const directory_snapshot&) = delete;
+
+        directory_snapshot& operator=(const directory_snapshot&) = delete;
+
+        // The number of directories in the snapshot.
+        [[nodiscard]] std::size_t size() const noexcept
+        {
+            return _listings.size();
+        }
+
+        /**********************************************************************************************//**
+         * @fn	bool directory_snapshot::load(const boost::filesystem::path& p)
+         *
+         * @brief	Replaces the listings with those saved in a file.
+         *
+         * @exception	std::system_error	Thrown if the file exists but cannot be read.
+         *
+         * @param 	p	The path of the snapshot file.
+         *
+         * @returns	true if the file was read; false if it does not exist or is not a valid snapshot,
+         * 			in which case the snapshot is left empty.
+         **************************************************************************************************/
+
+        bool load(const boost::filesystem::path& p)
+        {
+            _listings.clear();
+            _recorded.clear();
+
+            boost::system::error_code ec;
+            auto length = boost::filesystem::file_size(p, ec);
+            if (ec || (length < sizeof(_magic) + 2 * sizeof(uint32_t) + sizeof(uint64_t))) return false;
+
+#if defined (_MSC_VER)
+            FILE *file = _wfopen(p.wstring().c_str(), L"rb");
+#else
+            FILE *file = fopen64(p.string().c_str(), "rb");
+#endif
+            if (file == nullptr) throw std::system_error(errno, std::generic_category());
+            std::string data(static_cast<std::size_t>(length), '\0');
+            auto bytes_read = fread(data.data(), 1, data.size(), file);
+            fclose(file);
+            if (bytes_read != data.size()) return false;
+
+            uint32_t version = 0;
+            uint64_t checksum = 0;
+            std::memcpy(&version, data.data() + sizeof(_magic), sizeof(version));
+            std::memcpy(&checksum, data.data() + data.size() - sizeof(checksum), sizeof(checksum));
+            auto header = sizeof(_magic) + 2 * sizeof(uint32_t);
+            auto body = data.substr(header, data.size() - header - sizeof(checksum));
+            if ((std::memcmp(data.data(), _magic, sizeof(_magic)) != 0) || (version != _version) || (checksum != _checksum(body))) return false;
+            if (!_parse(body))
+            {
+                _listings.clear();
+                return false;
+            }
+
+            return true;
+        }
+
+        /**********************************************************************************************//**
+         * @fn	void directory_snapshot::save(const boost::filesystem::path& p) const
+         *
+         * @brief	Writes the current listings to a file, replacing it only once they are on the disk.
+         *
+         * @exception	std::system_error	Thrown if the file cannot be written.
+         **************************************************************************************************/
+
+        void save(const boost::filesystem::path& p) const
+        {
+            std::string body;
+            _put(body, static_cast<uint64_t>(_listings.size()));
+            for (const auto& [dir, l] : _listings)
+            {
+                _put(body, dir);
+                _put(body, _key(l->canonical));
+                _put(body, static_cast<uint64_t>(l->id.device));
+                _put(body, static_cast<uint64_t>(l->id.inode));
+                _put(body, l->times.modified);
+                _put(body, l->times.changed);
+                _put(body, static_cast<uint32_t>(l->entries.size()));
+                for (const auto& e : l->entries)
+                {
+                    _put(body, static_cast<uint8_t>(e.kind));
+                    _put(body, static_cast<uint8_t>(e.hidden ? 1 : 0));
+                    _put(body, _key(e.name));
+                }
+            }
+
+            std::string data(_magic, sizeof(_magic));
+            _put(data, _version);
+            _put(data, static_cast<uint32_t>(0));
+            data += body;
+            _put(data, _checksum(body));
+
+            auto temp = p;
+            temp += ".tmp";
+#if defined (_MSC_VER)
+            FILE *file = _wfopen(temp.wstring().c_str(), L"wb");
+#else
+            FILE *file = fopen64(temp.string().c_str(), "wb");
+#endif
+            if (file == nullptr) throw std::system_error(errno, std::generic_category());
+            bool written = (fwrite(data.data(), 1, data.size(), file) == data.size()) && (fflush(file) == 0);
+            int error = errno;
+#if !defined (_MSC_VER)
+            if (written) fsync(fileno(file));
+#endif
+            fclose(file);
+            if (!written)
+            {
+                boost::system::error_code ec;
+                boost::filesystem::remove(temp, ec);
+                throw std::system_error(error, std::generic_category());
+            }
+            boost::filesystem::rename(temp, p);
+        }
+
+        /**********************************************************************************************//**
+         * @fn	std::shared_ptr<const listing> directory_snapshot::find(const boost::filesystem::path& dir, const file_identity& id, const file_times& times) const
+         *
+         * @brief	Looks up the entries of a directory.
+         *
+         * @param 	dir  	The path of the directory, as the scan reached it.
+         * @param 	id   	The current device and inode of the directory.
+         * @param 	times	The current modification and status change times of the directory.
+         *
+         * @returns	The listing, or nullptr if the directory is not in the snapshot or has changed.
+         **************************************************************************************************/
+
+        [[nodiscard]] std::shared_ptr<const listing> find(const boost::filesystem::path& dir, const file_identity& id, const file_times& times) const
+        {
+            auto it = _listings.find(_key(dir));
+            if ((it == _listings.end()) || (it->second->id != id) || (it->second->times != times)) return nullptr;
+
+            return it->second;
+        }
+
+        // Keeps the listing of a directory for the next commit().
+        void record(const boost::filesystem::path& dir, std::shared_ptr<const listing> l)
+        {
+            auto key = _key(dir);
+            boost::lock_guard<boost::mutex> guard(_lock);
+            _recorded[std::move(key)] = std::move(l);
+        }
+
+        // Makes the listings recorded since the last commit the current ones.
+        void commit()
+        {
+            _listings.swap(_recorded);
+            _recorded.clear();
+        }
+
+        // Adds the listings recorded since the last commit to the current ones, for a scan that did not reach every
+        // directory. The directories it did not reach keep their listings.
+        void merge()
+        {
+            for (auto& [dir, l] : _recorded)
+            {
+                _listings[dir] = std::move(l);
+            }
+            _recorded.clear();
+        }
+    };
+}
+
+#endif //_DIRECTORY_SNAPSHOT_HPP_
@@ -23,6 +23,7 @@
 #include <stdexcept>
 #include <boost/filesystem.hpp>
 #include "foundation.hpp"
+#include "digest_key.hpp"
 
 #ifndef B1C51771_2BAB_4A66_8E74_43BAB9E3532A
 
@@ -40,7 +41,7 @@ namespace oasis::filesystem
     private:
         boost::filesystem::path _principal;
         std::set<boost::filesystem::path, SorterT> _set;
-        std::string _hash;
+        digest_key _hash;
     public:
         using reference = typename std::set<boost::filesystem::path, SorterT>::reference;
         using const_reference = typename std::set<boost::filesystem::path, SorterT>::const_reference;
@@ -51,7 +52,7 @@ namespace oasis::filesystem
         using difference_type = typename std::set<boost::filesystem::path, SorterT>::difference_type;
         using size_type = typename std::set<boost::filesystem::path, SorterT>::size_type;
 
-        template<typename T>
+        template<typename T, typename H>
         friend class duplicate_files_scanner;
 
         ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -112,38 +113,70 @@ namespace oasis::filesystem
         /// @brief Compares this instance to <tt>other</tt>.
         ///
         /// @param other The duplicate_file_set object to compare with this instance.
-        /// @return Returns a negative value if the hash string of this instance appears before the hash
-        ///         string of <tt>other</tt>, in lexicographical order.
+        /// @return Returns a negative value if the hash key of this instance orders before the hash key of
+        ///         <tt>other</tt>.
         ///
-        ///         Zero if both hash strings compare equivalent.
+        ///         Zero if both hash keys compare equivalent.
         ///
-        ///         A positive value if the hash string of this instance appears after the hash string of
-        ///         <tt>other</tt>, in lexicographical order.
+        ///         A positive value if the hash key of this instance orders after the hash key of
+        ///         <tt>other</tt>.
         ////////////////////////////////////////////////////////////////////////////////////////////////////
         [[nodiscard]] int compare(const duplicate_file_set& other) const noexcept
         {
             return _hash.compare(other._hash);
         }
 
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        /// @brief Compares this instance to the given hash key.
+        ///
+        /// @param hash A hash key to compare with the hash key of this instance.
+        /// @return Returns a negative, zero or positive value, as for compare(const duplicate_file_set&).
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        [[nodiscard]] int compare(const digest_key& hash) const noexcept
+        {
+            return _hash.compare(hash);
+        }
+
         ////////////////////////////////////////////////////////////////////////////////////////////////////
         /// @brief Compares this instance to <tt>other</tt>
         ///
         /// @tparam StringT An array of ASCII characters, of a type convertible to <tt>char</tt> or a string
         ///         type that satisfies the C++ named requirement: <em>Container</em>.
-        /// @param hash  A hash string to compare with the hash string of this instance.
-        /// @return @parblock Returns a negative value if the hash string of this instance appears before
-        ///         the hash string of <tt>other</tt>, in lexicographical order.
+        /// @param hash  A hash string, in the form produced by hash_string(), to compare with the hash key
+        ///         of this instance.
+        /// @return @parblock Returns a negative value if the hash key of this instance orders before the
+        ///         key parsed from <tt>hash</tt>.
         ///
-        ///         Zero if both hash strings compare equivalent.
+        ///         Zero if both hash keys compare equivalent.
         ///
-        ///         A positive value if the hash string of this instance appears after the hash string of
-        ///         <tt>other</tt>, in lexicographical order. @endparblock
+        ///         A positive value if the hash key of this instance orders after the key parsed from
+        ///         <tt>hash</tt>. @endparblock
+        /// @throws std::invalid_argument if <tt>hash</tt> is not a valid hash string.
         ////////////////////////////////////////////////////////////////////////////////////////////////////
         template<typename StringT>
-        [[nodiscard]] int compare(const StringT& hash) const noexcept
+        [[nodiscard]] int compare(const StringT& hash) const
         {
-            duplicate_file_set<SorterT> other(hash);
-            return _hash.compare(other._hash);
+            return _hash.compare(digest_key::from_string(hash));
+        }
+
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        /// @brief Gets the hash key shared by every file in this set.
+        ///
+        /// @return Returns a reference to the binary hash key of this set.
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        [[nodiscard]] const digest_key& hash() const noexcept
+        {
+            return _hash;
+        }
+
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        /// @brief Renders the hash key shared by every file in this set as a string.
+        ///
+        /// @return Returns the hash key in the form <tt>size:HEXDIGEST</tt>.
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        [[nodiscard]] std::string hash_string() const
+        {
+            return _hash.to_string();
         }
 
         ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -301,19 +334,14 @@ namespace oasis::filesystem
         ///
         /// @remark The path contained in the first entry in <tt>file_list</tt> will become the principal.
         ///
-        /// @tparam StringT An array of ASCII characters, of a type convertible to <tt>char</tt> or a string
-        ///         type that satisfies the C++ named requirement: <em>Container</em>.
         /// @tparam FileListT A list of <tt>boost::filesystem::path</tt> objects that satisfies the C++ named
         ///         requirement: <em>Container</em>.
-        /// @param hash The hash string of the files in <tt>file_list</tt>.
+        /// @param hash The hash key of the files in <tt>file_list</tt>.
         /// @param file_list A list of unique files with identical content.
         ////////////////////////////////////////////////////////////////////////////////////////////////////
-        template<typename StringT, typename FileListT>
-        duplicate_file_set(const StringT& hash, const FileListT& file_list)
+        template<typename FileListT>
+        duplicate_file_set(const digest_key& hash, const FileListT& file_list) : _hash(hash)
         {
-            if (std::any_of(hash.begin(), hash.end(), oasis::not_alphanumeric)) throw std::invalid_argument("Invalid hash string");
-            std::transform(hash.begin(), hash.end(), std::back_inserter(_hash), [](auto ch) { return static_cast<std::string::value_type>(ch & 0xFF); });
-
             for (const boost::filesystem::path& p : file_list)
             {
                 if (_principal.empty())
@@ -328,31 +356,13 @@ namespace oasis::filesystem
         }
 
         ////////////////////////////////////////////////////////////////////////////////////////////////////
-        /// @brief Construct a new duplicate file set object with the given hash string.
+        /// @brief Construct a new duplicate file set object with the given hash key.
         ///
-        /// @tparam StringT An array of ASCII characters, of a type convertible to <tt>char</tt> or a string
-        ///         type that satisfies the C++ named requirement: <em>Container</em>.
-        /// @param hash The hash string of files that will be added to this set.
+        /// @param hash The hash key of files that will be added to this set.
         ////////////////////////////////////////////////////////////////////////////////////////////////////
-        template<typename StringT>
-        explicit duplicate_file_set(const StringT& hash)
+        explicit duplicate_file_set(const digest_key& hash) : _hash(hash)
         {
-            if constexpr (std::is_pointer<StringT>::value || std::is_array<StringT>::value)
-            {
-                size_t idx = 0;
-                while (hash[idx] != 0)
-                {
-                    auto ch = hash[idx];
-                    if (!oasis::is_alphanumeric(ch)) throw std::invalid_argument("Invalid hash string");
-                    _hash.push_back(static_cast<std::string::value_type>(ch & 0xFF));
-                    idx++;
-                }
-            }
-            else
-            {
-                if (std::any_of(hash.begin(), hash.end(), oasis::not_alphanumeric)) throw std::invalid_argument("Invalid hash string");
-                std::transform(hash.begin(), hash.end(), std::back_inserter(_hash), [](auto ch) { return static_cast<std::string::value_type>(ch & 0xFF); });
-            }
+
         }
 
         ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -397,7 +407,7 @@ namespace oasis::filesystem
     };
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////
-    /// @brief Compares the hash strings of two duplicate_file_set objects for equality.
+    /// @brief Compares the hash keys of two duplicate_file_set objects for equality.
     ///
     ///        All comparisons are carried out using the compare() member function.
     ///
@@ -413,7 +423,7 @@ namespace oasis::filesystem
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////
-    /// @brief Compares the hash strings of two duplicate_file_set objects for inequality.
+    /// @brief Compares the hash keys of two duplicate_file_set objects for inequality.
     ///
     ///        All comparisons are carried out using the compare() member function.
     ///
@@ -429,8 +439,8 @@ namespace oasis::filesystem
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////
-    /// @brief Compares the hash strings of two duplicate_file_set objects to determine if <tt>lhs</tt>
-    ///        appears before <tt>rhs</tt>, in lexicographical order.
+    /// @brief Compares the hash keys of two duplicate_file_set objects to determine if <tt>lhs</tt>
+    ///        appears before <tt>rhs</tt>.
     ///
     ///        All comparisons are carried out using the compare() member function.
     ///
@@ -446,8 +456,8 @@ namespace oasis::filesystem
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////
-    /// @brief Compares the hash strings of two duplicate_file_set objects to determine if <tt>lhs</tt>
-    ///        appears after <tt>rhs</tt>, in lexicographical order.
+    /// @brief Compares the hash keys of two duplicate_file_set objects to determine if <tt>lhs</tt>
+    ///        appears after <tt>rhs</tt>.
     ///
     ///        All comparisons are carried out using the compare() member function.
     ///
@@ -463,8 +473,8 @@ namespace oasis::filesystem
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////
-    /// @brief Compares the hash strings of two duplicate_file_set objects to determine if <tt>lhs</tt>
-    ///        appears before or is equal to <tt>rhs</tt>, in lexicographical order.
+    /// @brief Compares the hash keys of two duplicate_file_set objects to determine if <tt>lhs</tt>
+    ///        appears before or is equal to <tt>rhs</tt>.
     ///
     ///        All comparisons are carried out using the compare() member function.
     ///
@@ -480,8 +490,8 @@ namespace oasis::filesystem
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////
-    /// @brief Compares the hash strings of two duplicate_file_set objects to determine if <tt>lhs</tt>
-    ///        appears after or is equal to <tt>rhs</tt>, in lexicographical order.
+    /// @brief Compares the hash keys of two duplicate_file_set objects to determine if <tt>lhs</tt>
+    ///        appears after or is equal to <tt>rhs</tt>.
     ///
     ///        All comparisons are carried out using the compare() member function.
     ///
@@ -497,16 +507,16 @@ namespace oasis::filesystem
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////
-    /// @brief Compares the hash string of <tt>lhs</tt> with <tt>rhs</tt> for equality.
+    /// @brief Compares the hash key of <tt>lhs</tt> with <tt>rhs</tt> for equality.
     ///
     ///        All comparisons are carried out using the compare() member function.
     ///
     /// @tparam SorterT A type that will be used to sort the files in the set.
     /// @tparam StringT An array of ASCII characters, of a type convertible to <tt>char</tt> or a string
     ///         type that satisfies the C++ named requirement: <em>Container</em>.
-    /// @param lhs A duplicate_file_set object, the hash string of which will be compared to
+    /// @param lhs A duplicate_file_set object, the hash key of which will be compared to
     ///            <tt>rhs</tt>
-    /// @param rhs A string to be compared to the hash string of <tt>lhs</tt>.
+    /// @param rhs A string to be compared to the hash key of <tt>lhs</tt>.
     /// @return Returns <tt>true</tt> if the comparison holds; otherwise <tt>false</tt>.
     ////////////////////////////////////////////////////////////////////////////////////////////////////
     template<typename SorterT, typename StringT>
@@ -516,16 +526,16 @@ namespace oasis::filesystem
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////
-    /// @brief Compares the hash string of <tt>lhs</tt> with <tt>rhs</tt> for inequality.
+    /// @brief Compares the hash key of <tt>lhs</tt> with <tt>rhs</tt> for inequality.
     ///
     ///        All comparisons are carried out using the compare() member function.
     ///
     /// @tparam SorterT A type that will be used to sort the files in the set.
     /// @tparam StringT An array of ASCII characters, of a type convertible to <tt>char</tt> or a string
     ///         type that satisfies the C++ named requirement: <em>Container</em>.
-    /// @param lhs A duplicate_file_set object, the hash string of which will be compared to
+    /// @param lhs A duplicate_file_set object, the hash key of which will be compared to
     ///            <tt>rhs</tt>
-    /// @param rhs A string to be compared to the hash string of <tt>lhs</tt>.
+    /// @param rhs A string to be compared to the hash key of <tt>lhs</tt>.
     /// @return Returns <tt>true</tt> if the comparison holds; otherwise <tt>false</tt>.
     ////////////////////////////////////////////////////////////////////////////////////////////////////
     template<typename SorterT, typename StringT>
@@ -535,17 +545,17 @@ namespace oasis::filesystem
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////
-    /// @brief Compares the hash string of <tt>lhs</tt> with <tt>rhs</tt> to determine if <tt>lhs</tt>
-    ///        appears before <tt>rhs</tt>, in lexicographical order.
+    /// @brief Compares the hash key of <tt>lhs</tt> with <tt>rhs</tt> to determine if <tt>lhs</tt>
+    ///        appears before <tt>rhs</tt>.
     ///
     ///        All comparisons are carried out using the compare() member function.
     ///
     /// @tparam SorterT A type that will be used to sort the files in the set.
     /// @tparam StringT An array of ASCII characters, of a type convertible to <tt>char</tt> or a string
     ///         type that satisfies the C++ named requirement: <em>Container</em>.
-    /// @param lhs A duplicate_file_set object, the hash string of which will be compared to
+    /// @param lhs A duplicate_file_set object, the hash key of which will be compared to
     ///            <tt>rhs</tt>
-    /// @param rhs A string to be compared to the hash string of <tt>lhs</tt>.
+    /// @param rhs A string to be compared to the hash key of <tt>lhs</tt>.
     /// @return Returns <tt>true</tt> if the comparison holds; otherwise <tt>false</tt>.
     ////////////////////////////////////////////////////////////////////////////////////////////////////
     template<typename SorterT, typename StringT>
@@ -555,17 +565,17 @@ namespace oasis::filesystem
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////
-    /// @brief Compares the hash string of <tt>lhs</tt> with <tt>rhs</tt> to determine if <tt>lhs</tt>
-    ///        appears after <tt>rhs</tt>, in lexicographical order.
+    /// @brief Compares the hash key of <tt>lhs</tt> with <tt>rhs</tt> to determine if <tt>lhs</tt>
+    ///        appears after <tt>rhs</tt>.
     ///
     ///        All comparisons are carried out using the compare() member function.
     ///
     /// @tparam SorterT A type that will be used to sort the files in the set.
     /// @tparam StringT An array of ASCII characters, of a type convertible to <tt>char</tt> or a string
     ///         type that satisfies the C++ named requirement: <em>Container</em>.
-    /// @param lhs A duplicate_file_set object, the hash string of which will be compared to
+    /// @param lhs A duplicate_file_set object, the hash key of which will be compared to
     ///            <tt>rhs</tt>
-    /// @param rhs A string to be compared to the hash string of <tt>lhs</tt>.
+    /// @param rhs A string to be compared to the hash key of <tt>lhs</tt>.
     /// @return Returns <tt>true</tt> if the comparison holds; otherwise <tt>false</tt>.
     ////////////////////////////////////////////////////////////////////////////////////////////////////
     template<typename SorterT, typename StringT>
@@ -575,17 +585,17 @@ namespace oasis::filesystem
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////
-    /// @brief Compares the hash string of <tt>lhs</tt> with <tt>rhs</tt> to determine if <tt>lhs</tt>
-    ///        appears before or is equal to <tt>rhs</tt>, in lexicographical order.
+    /// @brief Compares the hash key of <tt>lhs</tt> with <tt>rhs</tt> to determine if <tt>lhs</tt>
+    ///        appears before or is equal to <tt>rhs</tt>.
     ///
     ///        All comparisons are carried out using the compare() member function.
     ///
     /// @tparam SorterT A type that will be used to sort the files in the set.
     /// @tparam StringT An array of ASCII characters, of a type convertible to <tt>char</tt> or a string
     ///         type that satisfies the C++ named requirement: <em>Container</em>.
-    /// @param lhs A duplicate_file_set object, the hash string of which will be compared to
+    /// @param lhs A duplicate_file_set object, the hash key of which will be compared to
     ///            <tt>rhs</tt>
-    /// @param rhs A string to be compared to the hash string of <tt>lhs</tt>.
+    /// @param rhs A string to be compared to the hash key of <tt>lhs</tt>.
     /// @return Returns <tt>true</tt> if the comparison holds; otherwise <tt>false</tt>.
     ////////////////////////////////////////////////////////////////////////////////////////////////////
     template<typename SorterT, typename StringT>
@@ -595,17 +605,17 @@ namespace oasis::filesystem
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////
-    /// @brief Compares the hash string of <tt>lhs</tt> with <tt>rhs</tt> to determine if <tt>lhs</tt>
-    ///        appears after or is equal to <tt>rhs</tt>, in lexicographical order.
+    /// @brief Compares the hash key of <tt>lhs</tt> with <tt>rhs</tt> to determine if <tt>lhs</tt>
+    ///        appears after or is equal to <tt>rhs</tt>.
     ///
     ///        All comparisons are carried out using the compare() member function.
     ///
     /// @tparam SorterT A type that will be used to sort the files in the set.
     /// @tparam StringT An array of ASCII characters, of a type convertible to <tt>char</tt> or a string
     ///         type that satisfies the C++ named requirement: <em>Container</em>.
-    /// @param lhs A duplicate_file_set object, the hash string of which will be compared to
+    /// @param lhs A duplicate_file_set object, the hash key of which will be compared to
     ///            <tt>rhs</tt>
-    /// @param rhs A string to be compared to the hash string of <tt>lhs</tt>.
+    /// @param rhs A string to be compared to the hash key of <tt>lhs</tt>.
     /// @return Returns <tt>true</tt> if the comparison holds; otherwise <tt>false</tt>.
     ////////////////////////////////////////////////////////////////////////////////////////////////////
     template<typename SorterT, typename StringT>
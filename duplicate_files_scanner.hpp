@@ -2,6 +2,10 @@
 #include <fstream>
 #include <boost/filesystem.hpp>
 #include <map>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
 #include <forward_list>
 #include <tuple>
 #include <execution>
@@ -10,18 +14,47 @@
 #include <boost/thread.hpp>
 #include <mutex>
 #include <iterator>
+#include <exception>
 #include <openssl/evp.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/regex.hpp>
 #include "foundation.hpp"
 #include "directory_enumerator.hpp"
+#include "hash_policies.hpp"
+#include "digest_key.hpp"
+#include "thread_pool.hpp"
+#include "buffer_pool.hpp"
+#include "file_reader.hpp"
+#include "hash_cache.hpp"
+#include "directory_snapshot.hpp"
+#include "file_watcher.hpp"
+#include "scan_control.hpp"
+#include "scan_journal.hpp"
+#include "path_store.hpp"
+#include "digest_index.hpp"
 
 #ifndef _DUPLICATE_SCANNER_LIST_HPP_
 #define _DUPLICATE_SCANNER_LIST_HPP_
 
 namespace oasis::filesystem
 {
-    template<typename SorterT = sort_by_filename>
+    // How the members of a group of same sized files are told apart.
+    enum class comparison_strategy
+    {
+        digest,     // Head and tail blocks, then whole files, are hashed and grouped by digest.
+        lockstep,   // The members are read side by side and split as soon as their bytes differ, nothing is hashed.
+        progressive,    // As digest, but whole files are hashed in growing chunks and regrouped after every chunk.
+    };
+
+    // What happened to a set of duplicates, as reported to the set callback of duplicate_files_scanner.
+    enum class set_event
+    {
+        found,      // Two files were found to be identical, both are passed.
+        grown,      // Another file joined a set that had already been found, only the new file is passed.
+        dissolved,  // watch() took the set apart to refine it again, its files may be found again in other sets.
+    };
+
+    template<typename SorterT = sort_by_filename, typename HashT = sha512_hash>
     class duplicate_files_scanner : public directory_scanner
     {
     private:
@@ -31,54 +64,211 @@ namespace oasis::filesystem
         uintmax_t _file_count;
         uintmax_t _space_occupied;
         uintmax_t _sets_found;
-        boost::thread_group _threads;
+        uintmax_t _candidates;
+        uintmax_t _files_hashed;
+        uintmax_t _block_size;
+        uintmax_t _bytes_read;
+        uintmax_t _eliminated_by_size;
+        uintmax_t _eliminated_by_head;
+        uintmax_t _eliminated_by_tail;
+        uintmax_t _eliminated_by_full;
+        unsigned int _hash_threads;
+        unsigned int _traversal_threads;
+        bool _relative_traversal;
+        read_method _read_method;
+        unsigned int _queue_depth;
+        uintmax_t _mmap_threshold;
+        uintmax_t _files_read_buffered;
+        uintmax_t _files_read_io_uring;
+        uintmax_t _files_read_mapped;
+        std::size_t _read_buffer_size;
+        uintmax_t _buffer_limit;
+        bool _huge_pages;
+        comparison_strategy _strategy;
+        unsigned int _open_file_budget;
+        uintmax_t _progressive_chunk;
+        uintmax_t _bytes_avoided;
+        std::unique_ptr<thread_pool> _pool;
+        std::unique_ptr<buffer_pool> _buffers;
+        std::shared_ptr<hash_cache> _cache;
+        std::shared_ptr<directory_snapshot> _snapshot;
+        std::shared_ptr<scan_control> _control;
+        std::shared_ptr<scan_journal> _journal;
+        bool _resumed;
+        uintmax_t _directories_reused;
+        uintmax_t _directories_read;
+        int64_t _scan_started;
+        std::chrono::milliseconds _settle_time;
+        uintmax_t _change_events;
+        uintmax_t _updates;
+        uintmax_t _files_reexamined;
+        std::vector<boost::filesystem::path> *_collected;
+        std::map<boost::filesystem::path, uintmax_t> _watched;
+        boost::mutex _watch_lock;
+#if defined(OASIS_HAVE_FILE_WATCHER)
+        std::shared_ptr<file_watcher> _watcher;
+#endif
         std::function<void(const boost::filesystem::path&)> _scan_started_callback;
+        std::function<void(const boost::filesystem::path&, uintmax_t, uintmax_t)> _enumeration_progress_callback;
         std::function<void(const boost::filesystem::path&, uintmax_t, uintmax_t)> _scan_progress_callback;
         std::function<void(const boost::filesystem::path&, uintmax_t, uintmax_t, uintmax_t, uintmax_t)> _scan_completed_callback;
         std::function<void(const boost::filesystem::path&, const boost::filesystem::path&, const std::error_condition&)> _scan_error_callback;
-        using set_t = std::set<boost::filesystem::path, SorterT>;
-        using map_t = std::map<std::string, set_t>;
-        map_t _sets;
+        std::function<void(const boost::filesystem::path&, read_method, uintmax_t)> _file_read_callback;
+        std::function<void(const boost::filesystem::path&, uintmax_t, uintmax_t, uintmax_t, uintmax_t)> _sets_updated_callback;
+        std::function<void(set_event, const digest_key&, const std::vector<boost::filesystem::path>&)> _set_callback;
+        boost::mutex _set_callback_lock;
+        using partition_t = std::unordered_map<digest_key, std::vector<boost::filesystem::path>>;
+
+        // What was known about a file before it was read, a digest is only cached against this.
+        struct _stamp
+        {
+            file_identity id;
+            uintmax_t size = 0;
+            file_times times;
+            bool valid = false;
+        };
+
+        // A file waiting to be refined, with the digest of its head block once a worker has read it, or the digest of
+        // the whole file when it was found in the hash cache.
+        struct _candidate
+        {
+            boost::filesystem::path path;
+            digest_key head{};
+            bool valid = false;
+            file_identity id{};
+            std::vector<boost::filesystem::path> links{};
+            file_times times{};
+            bool cached = false;
+            digest_key full{};
+        };
+
+        enum class _stage
+        {
+            tail,
+            full,
+            progressive,
+        };
+
+        // Members of a size group that share a head digest and are being refined by the workers. The worker that
+        // completes the last member partitions the group and schedules the next stage.
+        struct _group
+        {
+            uintmax_t file_size;
+            _stage stage;
+            digest_key head;
+            std::vector<boost::filesystem::path> members;
+            std::vector<digest_key> keys;
+            std::vector<uint8_t> valid;
+            std::atomic<std::size_t> pending;
+
+            // Progressive rounds, each member keeps its hashing context from one round to the next.
+            std::vector<std::unique_ptr<HashT>> hashers;
+            uintmax_t position = 0;
+            uintmax_t chunk = 0;
+            uintmax_t length = 0;
+            std::vector<_stamp> stamps;
+
+            // Members whose digests came from the hash cache, they are only merged in once the others are hashed.
+            std::vector<std::pair<digest_key, boost::filesystem::path>> cached;
+        };
+
+        // A directory waiting to be walked, with its parent while that is held open so it can be opened relative to it.
+        struct _pending_directory
+        {
+            boost::filesystem::path path;
+            std::shared_ptr<const directory_handle> parent;
+        };
+
+        // Deques are used so candidates do not move while a worker is hashing them.
+        using size_map_t = std::map<uintmax_t, std::deque<_candidate>>;
+        // The sets are found by digest in a flat index, their files are ids into _paths, put in order when the sets are tallied.
+        digest_index _sets;
+        path_store _paths;
+        // The number of paths the store held after it was last built, watch() rebuilds it once it has doubled.
+        std::size_t _paths_kept;
+        size_map_t _size_groups;
+        std::map<file_identity, _candidate *> _inodes;
+        std::vector<std::vector<boost::filesystem::path>> _hard_links;
+        std::unique_ptr<work_stealing_queue<_pending_directory>> _directories;
+        std::atomic<unsigned int> _open_directories{ 0 };
 
         friend class unique_files_scanner;
 
-        void _process_filesystem_entry(const boost::filesystem::path& dirent, bool recurse);
-        void _process_file(boost::filesystem::path p);
+        void _process_directory(const _pending_directory& pending, bool recurse, std::size_t worker);
+        std::shared_ptr<const directory_handle> _open_directory(const _pending_directory& pending, boost::system::error_code& ec);
+        bool _process_filesystem_entry(const directory_entry& entry, bool recurse, std::size_t worker, directory_snapshot::listing *listing, bool relative);
+        void _consider_file(const boost::filesystem::path& p, const entry_status *status = nullptr);
+        void _add_candidate(const boost::filesystem::path& p, const entry_status *status = nullptr);
+        void _hash_head(uintmax_t file_size, _candidate *c);
+        void _collect_links(_candidate& c);
+        _stamp _take_stamp(const boost::filesystem::path& p);
+        void _remember(const _stamp& stamp, const digest_key& key);
+        void _refine_group(uintmax_t file_size, std::deque<_candidate>& members);
+        void _dispatch(const std::shared_ptr<_group>& g);
+        void _complete(const std::shared_ptr<_group>& g);
+        void _complete_round(const std::shared_ptr<_group>& g);
+        void _report_progress(const boost::filesystem::path& p);
+        bool _digest_range(const boost::filesystem::path& p, uintmax_t file_size, uintmax_t offset, uintmax_t length, digest_key& key);
+        bool _feed_range(const boost::filesystem::path& p, uintmax_t offset, uintmax_t length, HashT& hasher);
+        bool _use_io_uring() const;
+        void _record_read(const boost::filesystem::path& p, read_method method, uintmax_t length);
+        void _digest_batch(const std::shared_ptr<_group>& g, std::size_t first, std::size_t count, uintmax_t offset, uintmax_t length);
+        digest_key _combine_keys(const digest_key& first, const digest_key& second);
+        static HashT& _thread_hasher(std::size_t index = 0);
+        void _compare_group(uintmax_t file_size, std::vector<boost::filesystem::path> members, uintmax_t offset);
+        void _lockstep(uintmax_t file_size, std::vector<boost::filesystem::path> members, uintmax_t offset);
+        FILE *_open_at(const boost::filesystem::path& p, uintmax_t offset);
+        void _add_class(uintmax_t file_size, const std::vector<boost::filesystem::path>& members);
+        void _add_to_set(const digest_key& key, const boost::filesystem::path& p);
+        void _settle_group(uintmax_t file_size, std::deque<_candidate>& group);
+        void _tally();
+        void _compact_paths();
+        void _sort_members(path_store::id_type *first, std::size_t count);
+        void _walk(const std::vector<boost::filesystem::path>& roots, bool recurse);
+        void _flush_cache();
+        bool _checkpoint();
+        template <typename FuncT> void _log(FuncT record);
+        void _queue_directory(const boost::filesystem::path& dir, std::size_t worker, std::shared_ptr<const directory_handle> parent = nullptr);
+        bool _in_scope(const boost::filesystem::path& p, bool recurse);
+        void _apply_changes(const std::set<boost::filesystem::path>& files, const std::set<boost::filesystem::path>& dirs, bool recurse);
 
     public:
-        typedef typename map_t ::size_type size_type;
-        typedef set_t value_type;
-        typedef value_type& reference;
-        typedef const value_type& const_reference;
-        typedef typename map_t ::difference_type difference_type;
-        typedef value_type * pointer;
-        typedef const pointer const_pointer;
+        typedef std::size_t size_type;
+        typedef path_set value_type;
+        typedef value_type reference;
+        typedef value_type const_reference;
+        typedef std::ptrdiff_t difference_type;
 
+        // The sets are views of the ids they hold, the paths of their files are built as they are iterated.
         template<typename IterT>
         class basic_iterator
         {
         private:
             IterT under;
+            const digest_index *sets;
+            const path_store *store;
         public:
             typedef std::bidirectional_iterator_tag iterator_category;
-            typedef set_t value_type;
-            typedef typename map_t::difference_type difference_type;
-            typedef value_type& reference;
-            typedef value_type * pointer;
+            typedef path_set value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef value_type reference;
+            typedef void pointer;
 
-            explicit basic_iterator(IterT x)
+            basic_iterator(IterT x, const digest_index *i, const path_store *s)
             {
                 under = x;
+                sets = i;
+                store = s;
             }
 
             reference operator*() const
             {
-                return under->second;
+                return path_set(store, sets->members(*under));
             }
 
-            pointer operator->()
+            const digest_key& key() const
             {
-                return &under->second;
+                return under->key;
             }
 
             bool operator!=(const basic_iterator& o) const
@@ -113,69 +303,69 @@ namespace oasis::filesystem
             }
         };
 
-        typedef basic_iterator<typename map_t::iterator> iterator;
-        typedef basic_iterator<typename map_t::const_iterator> const_iterator;
-        typedef basic_iterator<typename map_t::reverse_iterator> reverse_iterator;
-        typedef basic_iterator<typename map_t::const_reverse_iterator> const_reverse_iterator;
+        typedef basic_iterator<digest_index::const_iterator> iterator;
+        typedef basic_iterator<digest_index::const_iterator> const_iterator;
+        typedef basic_iterator<digest_index::const_reverse_iterator> reverse_iterator;
+        typedef basic_iterator<digest_index::const_reverse_iterator> const_reverse_iterator;
 
         iterator begin() noexcept
         {
-            return iterator(_sets.begin());
+            return iterator(_sets.begin(), &_sets, &_paths);
         }
 
         [[nodiscard]] const_iterator begin() const noexcept
         {
-            return const_iterator(_sets.begin());
+            return const_iterator(_sets.begin(), &_sets, &_paths);
         }
 
         [[nodiscard]] const_iterator cbegin() const noexcept
         {
-            return const_iterator(_sets.cbegin());
+            return const_iterator(_sets.begin(), &_sets, &_paths);
         }
 
         [[nodiscard]] iterator end() noexcept
         {
-            return iterator(_sets.end());
+            return iterator(_sets.end(), &_sets, &_paths);
         }
 
         [[nodiscard]] const_iterator end() const noexcept
         {
-            return const_iterator(_sets.end());
+            return const_iterator(_sets.end(), &_sets, &_paths);
         }
 
         [[nodiscard]] const_iterator cend() const noexcept
         {
-            return const_iterator(_sets.cend());
+            return const_iterator(_sets.end(), &_sets, &_paths);
         }
 
         reverse_iterator rbegin() noexcept
         {
-            return reverse_iterator(_sets.rbegin());
+            return reverse_iterator(_sets.rbegin(), &_sets, &_paths);
         }
 
         [[nodiscard]] const_reverse_iterator rbegin() const noexcept
         {
-            return const_reverse_iterator(_sets.rbegin());
+            return const_reverse_iterator(_sets.rbegin(), &_sets, &_paths);
         }
 
         [[nodiscard]] const_reverse_iterator crbegin() const noexcept
         {
-            return const_reverse_iterator(_sets.crbegin());
+            return const_reverse_iterator(_sets.rbegin(), &_sets, &_paths);
         }
 
         reverse_iterator rend() noexcept
         {
-            return reverse_iterator(_sets.rend());
+            return reverse_iterator(_sets.rend(), &_sets, &_paths);
         }
 
         [[nodiscard]] const_reverse_iterator rend() const noexcept
         {
-            return const_reverse_iterator(_sets.rend());
+            return const_reverse_iterator(_sets.rend(), &_sets, &_paths);
         }
 
         [[nodiscard]] const_reverse_iterator crend() const noexcept
         {
-            return const_reverse_iterator(_sets.crend());
+            return const_reverse_iterator(_sets.rend(), &_sets, &_paths);
         }
 
         [[nodiscard]] bool empty() const noexcept override
@@ -191,6 +381,10 @@ namespace oasis::filesystem
         void clear() noexcept override
         {
             _sets.clear();
+            _paths.clear();
+            _paths_kept = 0;
+            _size_groups.clear();
+            _hard_links.clear();
         }
 
         void set_scan_started_callback(const std::function<void(const boost::filesystem::path&)>& callback)
@@ -198,11 +392,32 @@ namespace oasis::filesystem
             _scan_started_callback = callback;
         }
 
+        void set_enumeration_progress_callback(const std::function<void(const boost::filesystem::path&, uintmax_t, uintmax_t)>& callback)
+        {
+            _enumeration_progress_callback = callback;
+        }
+
         void set_scan_progress_callback(const std::function<void(const boost::filesystem::path&, uintmax_t, uintmax_t)>& callback)
         {
             _scan_progress_callback = callback;
         }
 
+        // Called as soon as a set of duplicates is confirmed, while the scan goes on, and again as it changes. The calls
+        // come from the hashing threads but never overlap, and the calls for one set arrive in order. The callback
+        // holds up the thread that confirmed the set, so lengthy work should be handed to another thread.
+        void set_set_callback(const std::function<void(set_event, const digest_key&, const std::vector<boost::filesystem::path>&)>& callback)
+        {
+            _set_callback = callback;
+        }
+
+        // Called on the watching thread after the sets have been brought up to date with a batch of changes, with the
+        // number of files that were examined again, the number of duplicate files, the number of sets and the space
+        // taken by the duplicates. The sets must not be read from another thread while a watch is running.
+        void set_sets_updated_callback(const std::function<void(const boost::filesystem::path&, uintmax_t, uintmax_t, uintmax_t, uintmax_t)>& callback)
+        {
+            _sets_updated_callback = callback;
+        }
+
         void set_scan_completed_callback(const std::function<void(const boost::filesystem::path&, uintmax_t, uintmax_t, uintmax_t, uintmax_t)>& callback)
         {
             _scan_completed_callback = callback;
@@ -213,6 +428,12 @@ namespace oasis::filesystem
             _scan_error_callback = callback;
         }
 
+        // Called from the hashing threads each time a range of a file has been read, with the method used and the number of bytes.
+        void set_file_read_callback(const std::function<void(const boost::filesystem::path&, read_method, uintmax_t)>& callback)
+        {
+            _file_read_callback = callback;
+        }
+
         [[nodiscard]] uintmax_t set_count() const
         {
             return _sets.size();
@@ -228,354 +449,2578 @@ namespace oasis::filesystem
             return _space_occupied;
         }
 
-        duplicate_files_scanner& operator=(duplicate_files_scanner&& other) noexcept
+        // Groups of paths that are hard links to the same file, each sorted by path. Only the first path of a group takes
+        // part in the duplicate sets, so space_occupied() only counts space that deleting files would actually free.
+        [[nodiscard]] const std::vector<std::vector<boost::filesystem::path>>& hard_links() const noexcept
         {
-            _sets = std::move(other._sets);
-            _sets_found = other._sets_found;
-            _follow_links = other._follow_links;
-            _remove_single = other._remove_single;
-            _files_encountered = other._files_encountered;
-            _extensions = std::move(other._extensions);
-            _file_count = other._file_count;
-            _space_occupied = other._space_occupied;
+            return _hard_links;
+        }
 
-            return *this;
+        [[nodiscard]] uintmax_t candidate_count() const noexcept
+        {
+            return _candidates;
         }
 
-        duplicate_files_scanner& operator=(const duplicate_files_scanner& other)
+        [[nodiscard]] uintmax_t files_hashed() const noexcept
         {
-            _sets = other._sets;
-            _sets_found = other._sets_found;
-            _follow_links = other._follow_links;
-            _remove_single = other._remove_single;
-            _files_encountered = other._files_encountered;
-            _extensions = other._extensions;
-            _file_count = other._file_count;
-            _space_occupied = other._space_occupied;
+            return _files_hashed;
+        }
 
-            return *this;
+        // The number of threads used to read and hash files, zero uses all of the CPUs available to the process.
+        [[nodiscard]] unsigned int hashing_threads() const noexcept
+        {
+            return _hash_threads;
         }
 
-        explicit duplicate_files_scanner(const boost::filesystem::path& p) : directory_scanner(p)
+        void set_hashing_threads(unsigned int value)
         {
-            _remove_single = true;
-            _file_count = 0;
-            _space_occupied = 0;
-            _sets_found = 0;
+            _hash_threads = value;
         }
 
-        duplicate_files_scanner(const duplicate_files_scanner& other) : directory_scanner(other)
+        // The number of threads walking the directory tree, zero uses all of the CPUs available to the process.
+        [[nodiscard]] unsigned int traversal_threads() const noexcept
         {
-            _sets = other._sets;
-            _follow_links = other._follow_links;
-            _remove_single = other._remove_single;
-            _files_encountered = other._files_encountered;
-            _extensions = other._extensions;
-            _file_count = other._file_count;
-            _space_occupied = other._space_occupied;
-            _sets_found = other._sets_found;
+            return _traversal_threads;
         }
 
-        duplicate_files_scanner(duplicate_files_scanner&& other) noexcept
+        void set_traversal_threads(unsigned int value)
         {
-            _sets = std::move(other._sets);
-            _follow_links = other._follow_links;
-            _remove_single = other._remove_single;
-            _files_encountered = other._files_encountered;
-            _extensions = std::move(other._extensions);
-            _file_count = other._file_count;
-            _space_occupied = other._space_occupied;
-            _sets_found = 0;
+            _traversal_threads = value;
         }
 
-        void perform_scan(bool recurse) override;
+        // On Linux the walkers keep directories open while their sub-directories are queued, and open and examine every
+        // entry relative to its directory instead of resolving its path again from the root. A few hundred directories
+        // at most are held open at once, the others are opened by their paths, and a paused scan keeps them open. It has
+        // no effect on other systems.
+        [[nodiscard]] bool relative_traversal() const noexcept
+        {
+            return _relative_traversal;
+        }
 
-    };
+        void set_relative_traversal(bool value)
+        {
+            _relative_traversal = value;
+        }
 
-    template<typename SorterT>
-    void duplicate_files_scanner<SorterT>::perform_scan(bool recurse)
-    {
-        if (_scan_started_callback) _scan_started_callback(_search_dir);
+        // How file contents are read once a size group needs its tails or full contents. io_uring keeps up to
+        // io_queue_depth() files in flight on each hashing thread, it falls back to buffered reads when the kernel does
+        // not support it or the process is not allowed to use it. memory_mapped hashes ranges of at least
+        // memory_map_threshold() bytes straight from a mapping of the file, smaller ranges are read buffered. The size of
+        // the file is checked before each window is mapped, but one that is truncated while a window of it is being
+        // hashed raises SIGBUS, which the scanner does not handle. memory_mapped is only safe where files are not being
+        // truncated during a scan, such as on read-only or quiescent trees, and should not be combined with watch().
+        [[nodiscard]] read_method file_read_method() const noexcept
+        {
+            return _read_method;
+        }
 
-        boost::system::error_code ec;
-        directory_enumerator de(_search_dir);
-        while (de.move_next(ec))
+        void set_file_read_method(read_method value)
         {
-            _process_filesystem_entry(de.current(), recurse);
+            _read_method = value;
         }
-        if (ec && _scan_error_callback) _scan_error_callback(_search_dir, boost::filesystem::path(), ec.default_error_condition());
 
-        // Wait for threads.
-        //_threads.join_all();
+        [[nodiscard]] unsigned int io_queue_depth() const noexcept
+        {
+            return _queue_depth;
+        }
 
-        // Work out the statistics.
-        std::set<std::string> del_list;
-        for (const auto& k : _sets)
+        void set_io_queue_depth(unsigned int value)
         {
-            if (k.second.size() == 1)
-            {
-                if (_remove_single)
-                {
-                    del_list.insert(k.first);
-                    continue;
-                }
-                _file_count++;
-                boost::filesystem::path px = *(k.second.begin());
-                _space_occupied += boost::filesystem::file_size(px, ec);
-                if (ec && _scan_error_callback) _scan_error_callback(_search_dir, px, ec.default_error_condition());
-            }
-            else
-            {
-                _file_count += k.second.size() - 1;
-                boost::filesystem::path px = *(k.second.begin());
-                auto fsize = boost::filesystem::file_size(px, ec);
-                if (ec && _scan_error_callback) _scan_error_callback(_search_dir, px, ec.default_error_condition());
-                _space_occupied += (fsize * (k.second.size() - 1));
-            }
+            if (value == 0) throw std::invalid_argument("The queue depth cannot be zero");
+            _queue_depth = value;
         }
 
-        if (_remove_single)
+        [[nodiscard]] uintmax_t memory_map_threshold() const noexcept
         {
-            for (const auto& kr: del_list)
+            return _mmap_threshold;
+        }
+
+        void set_memory_map_threshold(uintmax_t value)
+        {
+            _mmap_threshold = value;
+        }
+
+        // The number of file ranges that were read with the given method during the last scan.
+        [[nodiscard]] uintmax_t files_read(read_method method) const noexcept
+        {
+            switch (method)
             {
-                _sets.erase(kr);
+                case read_method::io_uring:
+                    return _files_read_io_uring;
+                case read_method::memory_mapped:
+                    return _files_read_mapped;
+                default:
+                    return _files_read_buffered;
             }
         }
 
-        if (_scan_completed_callback) _scan_completed_callback(_search_dir, _files_encountered, _file_count, _sets.size(), _space_occupied);
-    }
+        // Read buffers are borrowed from a pool shared by the hashing threads, together they never occupy more than
+        // buffer_memory_limit() bytes, a thread waits for a buffer to be returned rather than exceed it.
+        [[nodiscard]] std::size_t read_buffer_size() const noexcept
+        {
+            return _read_buffer_size;
+        }
 
-    template<typename SorterT>
-    void duplicate_files_scanner<SorterT>::_process_filesystem_entry(const boost::filesystem::path& dirent, bool recurse)
-    {
-        boost::system::error_code ec;
-        boost::filesystem::path p;
-        bool hidden = is_hidden(dirent, ec);
-        if (ec)
+        void set_read_buffer_size(std::size_t value)
         {
-            if (_scan_error_callback) _scan_error_callback(_search_dir, dirent, ec.default_error_condition());
-            return;
+            if (value == 0) throw std::invalid_argument("The read buffer size cannot be zero");
+            _read_buffer_size = value;
         }
-        bool symlink = boost::filesystem::is_symlink(dirent, ec);
-        if (ec)
+
+        [[nodiscard]] uintmax_t buffer_memory_limit() const noexcept
         {
-            if (_scan_error_callback) _scan_error_callback(_search_dir, dirent, ec.default_error_condition());
-            return;
+            return _buffer_limit;
         }
 
-        if (_skip_hidden && hidden) return;
+        void set_buffer_memory_limit(uintmax_t value)
+        {
+            _buffer_limit = value;
+        }
 
-        if (symlink)
+        [[nodiscard]] bool use_huge_pages() const noexcept
         {
-            if (_follow_links)
-            {
-                p = boost::filesystem::canonical(dirent, ec);
-                if (ec)
-                {
-                    if (_scan_error_callback) _scan_error_callback(_search_dir, dirent, ec.default_error_condition());
-                    return;
-                }
-            }
-            else
-            {
-                return;
-            }
+            return _huge_pages;
         }
-        else
+
+        void set_use_huge_pages(bool value)
         {
-            p = boost::filesystem::canonical(dirent, ec);
-            if (ec)
-            {
-                if (_scan_error_callback) _scan_error_callback(_search_dir, dirent, ec.default_error_condition());
-                return;
-            }
+            _huge_pages = value;
         }
 
-        if (!boost::filesystem::exists(p, ec) && !ec) return;
-        if (ec)
+        // With the lockstep strategy sets are keyed by the file size and a digest of a member's path rather than of the contents, and no more than
+        // open_file_budget() files are open at once on each hashing thread. Larger groups are first split on the raw
+        // contents of successive blocks, reading one file at a time, until every part fits within the budget.
+        [[nodiscard]] comparison_strategy strategy() const noexcept
         {
-            if (_scan_error_callback) _scan_error_callback(_search_dir, p, ec.default_error_condition());
-            return;
+            return _strategy;
         }
 
-        // ---------------------------------------------------------------------------------------------------------
-        // Directory.
-        // ---------------------------------------------------------------------------------------------------------
-        bool directory = boost::filesystem::is_directory(p, ec);
-        if (ec)
+        void set_strategy(comparison_strategy value)
         {
-            if (_scan_error_callback) _scan_error_callback(_search_dir, p, ec.default_error_condition());
-            return;
+            _strategy = value;
         }
-        boost::system::error_code sec;
-        if (directory)
+
+        // The progressive strategy reads this much of every file in its first round, and four times as much in each
+        // round after that.
+        [[nodiscard]] uintmax_t progressive_chunk_size() const noexcept
         {
-            directory_enumerator de(p);
-            while (de.move_next(sec))
-            {
-                _process_filesystem_entry(de.current(), recurse);
-            }
-            if (sec && _scan_error_callback) _scan_error_callback(_search_dir, p, sec.default_error_condition());
+            return _progressive_chunk;
         }
 
-        // ---------------------------------------------------------------------------------------------------------
-        // File.
-        // ---------------------------------------------------------------------------------------------------------
-        if (!boost::filesystem::is_regular_file(p, ec) && !ec) return;
-        if (ec)
+        void set_progressive_chunk_size(uintmax_t value)
         {
-            if (_scan_error_callback) _scan_error_callback(_search_dir, p, ec.default_error_condition());
-            return;
+            if (value == 0) throw std::invalid_argument("The chunk size cannot be zero");
+            _progressive_chunk = value;
         }
 
-        if (!_extensions.empty())
+        // The bytes of candidate files that were never read because the progressive strategy found them unique early.
+        [[nodiscard]] uintmax_t bytes_avoided() const noexcept
         {
-            std::cout << "EXTENSIONS NOT EMPTY!!" << std::endl;
-            auto e = p.extension().string();
-            if (!_extensions.contains(e)) return;
+            return _bytes_avoided;
         }
 
-        /*try
+        // Digests of whole files are looked up in the cache before a file is read, and stored in it once computed. The
+        // cache must have been opened with the name of the hash policy of this scanner. It is not used by the lockstep
+        // strategy, which computes no digests.
+        [[nodiscard]] const std::shared_ptr<hash_cache>& cache() const noexcept
         {
-            // Try to run the add routine on a separate thread...
-            _threads.create_thread([p, this]() { _add_to_set(p); });
+            return _cache;
         }
-        catch(...)
+
+        void set_cache(const std::shared_ptr<hash_cache>& value)
         {
-            // If we cannot, we will have to run it on the main thread.
-            _process_file(p);
-        } */
+            if (value && (value->algorithm() != HashT::name())) throw std::invalid_argument("The cache holds digests made with a different hash algorithm");
+            _cache = value;
+        }
 
-        _process_file(p);
-    }
+        // When a snapshot is set, directories whose device, inode, modification and status change times are unchanged
+        // since the snapshot was taken are not read again, the entries recorded for them are used instead. Every scan
+        // replaces the contents of the snapshot with the directories it found, the caller saves it to disk.
+        [[nodiscard]] const std::shared_ptr<directory_snapshot>& snapshot() const noexcept
+        {
+            return _snapshot;
+        }
 
-    template <typename SorterT>
-    void duplicate_files_scanner<SorterT>::_process_file(boost::filesystem::path p)
-    {
-        boost::system::error_code ec;
-        _counter_lock.lock();
-        _files_encountered++;
-        _counter_lock.unlock();
+        void set_snapshot(const std::shared_ptr<directory_snapshot>& value)
+        {
+            _snapshot = value;
+        }
 
-        boost::filesystem::path directory = p;
-        directory.remove_filename();
+        // When a journal is set the scan records its progress in it as it goes. A scan of the same directory with the
+        // same options that finds an unfinished scan in the journal resumes it: it walks only the directories that were
+        // not finished, and only reads the files that changed since their digests were recorded. A cancelled scan can
+        // be resumed in the same way. The lockstep strategy computes no digests, so it resumes only the walk.
+        [[nodiscard]] const std::shared_ptr<scan_journal>& journal() const noexcept
+        {
+            return _journal;
+        }
 
-        unsigned char digest[EVP_MAX_MD_SIZE];
-        std::stringstream ss;
-        std::string h;
-        //std::unique_ptr<uint8_t, free_delete> _buffer;
-        auto file_size = boost::filesystem::file_size(p, ec);
-        if (ec)
+        void set_journal(const std::shared_ptr<scan_journal>& value)
         {
-            if (_scan_error_callback) _scan_error_callback(directory, p, ec.default_error_condition());
-            return;
+            _journal = value;
         }
-        if ((file_size < _min_size) || (file_size > _max_size)) return;
 
-        // Try to get some memory.
-        size_t buffer_size = (file_size < 10485760) ? file_size : 10485760;
-        auto _buffer = make_buffer(buffer_size);
+        // Whether the last scan carried on from a journal.
+        [[nodiscard]] bool resumed() const noexcept
+        {
+            return _resumed;
+        }
 
-        EVP_MD_CTX *evp_ctx = EVP_MD_CTX_new();
+        // Pauses, resumes or cancels a scan from another thread. The walkers look at the control before each directory,
+        // the hashing threads before each file and between the chunks of a file, a paused thread closes its files and
+        // returns its buffers first. A cancelled scan returns with the sets that were confirmed by then, and the snapshot
+        // keeps the directories that were not reached. The control stays cancelled until it is reset, and must not be
+        // replaced while a scan is running.
+        [[nodiscard]] const std::shared_ptr<scan_control>& control() const noexcept
+        {
+            return _control;
+        }
 
-        // Try to open the file.
-        FILE *file = nullptr;
-        for (;;)
+        void set_control(const std::shared_ptr<scan_control>& value)
         {
-#if defined (_MSC_VER)
-            file = _wfopen(p.wstring().c_str(), L"rbS");
-#else
-            file = fopen64(p.string().c_str(), "rb");
+            if (!value) throw std::invalid_argument("The scan control cannot be null");
+            _control = value;
+        }
+
+        void pause()
+        {
+            _control->pause();
+        }
+
+        void resume()
+        {
+            _control->resume();
+        }
+
+        // Also makes a running watch() return.
+        void cancel()
+        {
+            _control->cancel();
+#if defined(OASIS_HAVE_FILE_WATCHER)
+            stop_watching();
 #endif
-            if (file == nullptr)
-            {
-                if ((errno == ENFILE) || (errno == EMFILE) || (errno == ENOSR) || (errno == EAGAIN))
-                {
-                    boost::this_thread::sleep_for(boost::chrono::seconds(5));
-                    sleep(5);
-                    continue;
-                }
-                else
-                {
-                    ec = boost::system::error_code(errno, boost::system::system_category());
-                    if (_scan_error_callback) _scan_error_callback(directory, p, ec.default_error_condition());
-                    return;
-                }
-            }
-            else
-            {
-                break;
-            }
         }
 
-        // Start building the hash string key.
-        ss << file_size << ":";
+        // Whether the last scan was cut short by cancel().
+        [[nodiscard]] bool cancelled() const noexcept
+        {
+            return _control->cancelled();
+        }
 
-        // Deal with zero byte files
-        if (file_size == 0)
+        // The directories whose entries were taken from the snapshot.
+        [[nodiscard]] uintmax_t directories_reused() const noexcept
         {
-            h = "0:0";
+            return _directories_reused;
         }
-        else if (file_size <= EVP_MAX_MD_SIZE) // If the contents of the file will fit inside the hash buffer then we can save a pointless hashing operation.
+
+        // The directories that were read.
+        [[nodiscard]] uintmax_t directories_read() const noexcept
         {
-            auto bytes_read = fread(digest, 1, file_size, file);
-            if (bytes_read != file_size)
-            {
-                ec = boost::system::error_code(errno, boost::system::system_category());
-                if (_scan_error_callback) _scan_error_callback(directory, p, ec.default_error_condition());
-                fclose(file);
-                return;
-            }
-            char *hex_out = OPENSSL_buf2hexstr(digest, file_size);
-            ss << hex_out;
-            OPENSSL_free(hex_out);
-            h = ss.str();
+            return _directories_read;
         }
-        else
+
+        // A file is examined again once no change to it has been reported for this long, so a burst of writes to a file
+        // costs one examination.
+        [[nodiscard]] std::chrono::milliseconds settle_time() const noexcept
         {
-            EVP_DigestInit(evp_ctx, EVP_sha512());
-#if defined (_MSC_VER)
-            while (!feof(file) && (_ftelli64 < file_size))
-#else
-            while (!feof(file) && (ftello64(file) < file_size))
-#endif
-            {
-                auto bytes_read = fread(_buffer.get(), 1, buffer_size, file);
-                if ((bytes_read == 0) || ferror(file))
-                {
-                    ec = boost::system::error_code(errno, boost::system::system_category());
-                    if (_scan_error_callback) _scan_error_callback(directory, p, ec.default_error_condition());
-                    fclose(file);
-                    EVP_MD_CTX_free(evp_ctx);
-                    return;
-                }
-                EVP_DigestUpdate(evp_ctx, _buffer.get(), bytes_read);
-            }
-            EVP_DigestFinal(evp_ctx, digest, nullptr);
-            char *hex_out = OPENSSL_buf2hexstr(digest, EVP_MAX_MD_SIZE);
-            ss << hex_out;
-            OPENSSL_free(hex_out);
-            h = ss.str();
+            return _settle_time;
         }
-        fclose(file);
 
-        // Free the memory as soon as we are finished with it.
-        _buffer.reset();
+        void set_settle_time(std::chrono::milliseconds value)
+        {
+            if (value.count() < 0) throw std::invalid_argument("The settle time cannot be negative");
+            _settle_time = value;
+        }
 
-        // Query set for discovered hash.
-        _list_lock.lock();
-        if (_sets.contains(h))
+        // The changes reported to watch(), before they were coalesced.
+        [[nodiscard]] uintmax_t change_events() const noexcept
         {
-            _sets.at(h).emplace(p);
-            if (_sets.at(h).size() == 2) _sets_found++;
+            return _change_events;
         }
-        else
+
+        // The batches of changes that watch() has applied to the sets.
+        [[nodiscard]] uintmax_t updates() const noexcept
         {
-            auto result = _sets.emplace(std::make_pair(h, set_t()));
-            if (result.second) result.first->second.emplace(p);
+            return _updates;
         }
-        _list_lock.unlock();
-        if (_scan_progress_callback) _scan_progress_callback(directory, _files_encountered, _sets_found);
+
+        // The files that watch() examined again, including the files of the same size as a changed file.
+        [[nodiscard]] uintmax_t files_reexamined() const noexcept
+        {
+            return _files_reexamined;
+        }
+
+        [[nodiscard]] unsigned int open_file_budget() const noexcept
+        {
+            return _open_file_budget;
+        }
+
+        void set_open_file_budget(unsigned int value)
+        {
+            if (value < 2) throw std::invalid_argument("At least two files must be open to compare them");
+            _open_file_budget = value;
+        }
+
+        [[nodiscard]] uintmax_t partial_block_size() const noexcept
+        {
+            return _block_size;
+        }
+
+        void set_partial_block_size(uintmax_t value)
+        {
+            if (value == 0) throw std::invalid_argument("The partial block size cannot be zero");
+            _block_size = value;
+        }
+
+        [[nodiscard]] uintmax_t bytes_read() const noexcept
+        {
+            return _bytes_read;
+        }
+
+        [[nodiscard]] uintmax_t files_eliminated_by_size() const noexcept
+        {
+            return _eliminated_by_size;
+        }
+
+        [[nodiscard]] uintmax_t files_eliminated_by_head() const noexcept
+        {
+            return _eliminated_by_head;
+        }
+
+        [[nodiscard]] uintmax_t files_eliminated_by_tail() const noexcept
+        {
+            return _eliminated_by_tail;
+        }
+
+        // Includes the files found to be unique by lockstep comparison.
+        [[nodiscard]] uintmax_t files_eliminated_by_full() const noexcept
+        {
+            return _eliminated_by_full;
+        }
+
+        duplicate_files_scanner& operator=(duplicate_files_scanner&& other) noexcept
+        {
+            _sets = std::move(other._sets);
+            _paths = std::move(other._paths);
+            _paths_kept = other._paths_kept;
+            _sets_found = other._sets_found;
+            _follow_links = other._follow_links;
+            _remove_single = other._remove_single;
+            _files_encountered = other._files_encountered;
+            _extensions = std::move(other._extensions);
+            _file_count = other._file_count;
+            _space_occupied = other._space_occupied;
+            _candidates = other._candidates;
+            _files_hashed = other._files_hashed;
+            _block_size = other._block_size;
+            _bytes_read = other._bytes_read;
+            _eliminated_by_size = other._eliminated_by_size;
+            _eliminated_by_head = other._eliminated_by_head;
+            _eliminated_by_tail = other._eliminated_by_tail;
+            _eliminated_by_full = other._eliminated_by_full;
+            _hash_threads = other._hash_threads;
+            _traversal_threads = other._traversal_threads;
+            _relative_traversal = other._relative_traversal;
+            _read_method = other._read_method;
+            _queue_depth = other._queue_depth;
+            _mmap_threshold = other._mmap_threshold;
+            _files_read_buffered = other._files_read_buffered;
+            _files_read_io_uring = other._files_read_io_uring;
+            _files_read_mapped = other._files_read_mapped;
+            _read_buffer_size = other._read_buffer_size;
+            _buffer_limit = other._buffer_limit;
+            _huge_pages = other._huge_pages;
+            _strategy = other._strategy;
+            _open_file_budget = other._open_file_budget;
+            _progressive_chunk = other._progressive_chunk;
+            _bytes_avoided = other._bytes_avoided;
+            _size_groups = std::move(other._size_groups);
+            _hard_links = std::move(other._hard_links);
+            _cache = std::move(other._cache);
+            _snapshot = std::move(other._snapshot);
+            _journal = std::move(other._journal);
+            _resumed = other._resumed;
+            _control = other._control;
+            _directories_reused = other._directories_reused;
+            _directories_read = other._directories_read;
+            _settle_time = other._settle_time;
+            _change_events = other._change_events;
+            _updates = other._updates;
+            _files_reexamined = other._files_reexamined;
+            _collected = nullptr;
+
+            return *this;
+        }
+
+        duplicate_files_scanner& operator=(const duplicate_files_scanner& other)
+        {
+            _sets = other._sets;
+            _paths = other._paths;
+            _paths_kept = other._paths_kept;
+            _sets_found = other._sets_found;
+            _follow_links = other._follow_links;
+            _remove_single = other._remove_single;
+            _files_encountered = other._files_encountered;
+            _extensions = other._extensions;
+            _file_count = other._file_count;
+            _space_occupied = other._space_occupied;
+            _candidates = other._candidates;
+            _files_hashed = other._files_hashed;
+            _block_size = other._block_size;
+            _bytes_read = other._bytes_read;
+            _eliminated_by_size = other._eliminated_by_size;
+            _eliminated_by_head = other._eliminated_by_head;
+            _eliminated_by_tail = other._eliminated_by_tail;
+            _eliminated_by_full = other._eliminated_by_full;
+            _hash_threads = other._hash_threads;
+            _traversal_threads = other._traversal_threads;
+            _relative_traversal = other._relative_traversal;
+            _read_method = other._read_method;
+            _queue_depth = other._queue_depth;
+            _mmap_threshold = other._mmap_threshold;
+            _files_read_buffered = other._files_read_buffered;
+            _files_read_io_uring = other._files_read_io_uring;
+            _files_read_mapped = other._files_read_mapped;
+            _read_buffer_size = other._read_buffer_size;
+            _buffer_limit = other._buffer_limit;
+            _huge_pages = other._huge_pages;
+            _strategy = other._strategy;
+            _open_file_budget = other._open_file_budget;
+            _progressive_chunk = other._progressive_chunk;
+            _bytes_avoided = other._bytes_avoided;
+            _size_groups = other._size_groups;
+            _hard_links = other._hard_links;
+            _cache = other._cache;
+            _snapshot = other._snapshot;
+            _journal = other._journal;
+            _resumed = other._resumed;
+            _directories_reused = other._directories_reused;
+            _directories_read = other._directories_read;
+            _settle_time = other._settle_time;
+            _change_events = other._change_events;
+            _updates = other._updates;
+            _files_reexamined = other._files_reexamined;
+            _collected = nullptr;
+
+            return *this;
+        }
+
+        explicit duplicate_files_scanner(const boost::filesystem::path& p) : directory_scanner(p)
+        {
+            _remove_single = true;
+            _file_count = 0;
+            _space_occupied = 0;
+            _sets_found = 0;
+            _candidates = 0;
+            _files_hashed = 0;
+            _block_size = 4096;
+            _bytes_read = 0;
+            _eliminated_by_size = 0;
+            _eliminated_by_head = 0;
+            _eliminated_by_tail = 0;
+            _eliminated_by_full = 0;
+            _hash_threads = 0;
+            _traversal_threads = 0;
+            _relative_traversal = true;
+            _read_method = read_method::buffered;
+            _queue_depth = 32;
+            _mmap_threshold = 16777216;
+            _files_read_buffered = 0;
+            _files_read_io_uring = 0;
+            _files_read_mapped = 0;
+            _read_buffer_size = 1048576;
+            _buffer_limit = 268435456;
+            _huge_pages = false;
+            _strategy = comparison_strategy::digest;
+            _open_file_budget = 64;
+            _progressive_chunk = 1048576;
+            _bytes_avoided = 0;
+            _control = std::make_shared<scan_control>();
+            _resumed = false;
+            _directories_reused = 0;
+            _directories_read = 0;
+            _settle_time = std::chrono::milliseconds(500);
+            _change_events = 0;
+            _updates = 0;
+            _files_reexamined = 0;
+            _collected = nullptr;
+            _paths_kept = 0;
+        }
+
+        duplicate_files_scanner(const duplicate_files_scanner& other) : directory_scanner(other)
+        {
+            _sets = other._sets;
+            _paths = other._paths;
+            _paths_kept = other._paths_kept;
+            _follow_links = other._follow_links;
+            _remove_single = other._remove_single;
+            _files_encountered = other._files_encountered;
+            _extensions = other._extensions;
+            _file_count = other._file_count;
+            _space_occupied = other._space_occupied;
+            _sets_found = other._sets_found;
+            _candidates = other._candidates;
+            _files_hashed = other._files_hashed;
+            _block_size = other._block_size;
+            _bytes_read = other._bytes_read;
+            _eliminated_by_size = other._eliminated_by_size;
+            _eliminated_by_head = other._eliminated_by_head;
+            _eliminated_by_tail = other._eliminated_by_tail;
+            _eliminated_by_full = other._eliminated_by_full;
+            _hash_threads = other._hash_threads;
+            _traversal_threads = other._traversal_threads;
+            _relative_traversal = other._relative_traversal;
+            _read_method = other._read_method;
+            _queue_depth = other._queue_depth;
+            _mmap_threshold = other._mmap_threshold;
+            _files_read_buffered = other._files_read_buffered;
+            _files_read_io_uring = other._files_read_io_uring;
+            _files_read_mapped = other._files_read_mapped;
+            _read_buffer_size = other._read_buffer_size;
+            _buffer_limit = other._buffer_limit;
+            _huge_pages = other._huge_pages;
+            _strategy = other._strategy;
+            _open_file_budget = other._open_file_budget;
+            _progressive_chunk = other._progressive_chunk;
+            _bytes_avoided = other._bytes_avoided;
+            _size_groups = other._size_groups;
+            _hard_links = other._hard_links;
+            _cache = other._cache;
+            _snapshot = other._snapshot;
+            _journal = other._journal;
+            _resumed = other._resumed;
+            _control = std::make_shared<scan_control>();
+            _directories_reused = other._directories_reused;
+            _directories_read = other._directories_read;
+            _settle_time = other._settle_time;
+            _change_events = other._change_events;
+            _updates = other._updates;
+            _files_reexamined = other._files_reexamined;
+            _collected = nullptr;
+        }
+
+        duplicate_files_scanner(duplicate_files_scanner&& other) noexcept
+        {
+            _sets = std::move(other._sets);
+            _paths = std::move(other._paths);
+            _paths_kept = other._paths_kept;
+            _follow_links = other._follow_links;
+            _remove_single = other._remove_single;
+            _files_encountered = other._files_encountered;
+            _extensions = std::move(other._extensions);
+            _file_count = other._file_count;
+            _space_occupied = other._space_occupied;
+            _sets_found = 0;
+            _candidates = other._candidates;
+            _files_hashed = other._files_hashed;
+            _block_size = other._block_size;
+            _bytes_read = other._bytes_read;
+            _eliminated_by_size = other._eliminated_by_size;
+            _eliminated_by_head = other._eliminated_by_head;
+            _eliminated_by_tail = other._eliminated_by_tail;
+            _eliminated_by_full = other._eliminated_by_full;
+            _hash_threads = other._hash_threads;
+            _traversal_threads = other._traversal_threads;
+            _relative_traversal = other._relative_traversal;
+            _read_method = other._read_method;
+            _queue_depth = other._queue_depth;
+            _mmap_threshold = other._mmap_threshold;
+            _files_read_buffered = other._files_read_buffered;
+            _files_read_io_uring = other._files_read_io_uring;
+            _files_read_mapped = other._files_read_mapped;
+            _read_buffer_size = other._read_buffer_size;
+            _buffer_limit = other._buffer_limit;
+            _huge_pages = other._huge_pages;
+            _strategy = other._strategy;
+            _open_file_budget = other._open_file_budget;
+            _progressive_chunk = other._progressive_chunk;
+            _bytes_avoided = other._bytes_avoided;
+            _size_groups = std::move(other._size_groups);
+            _hard_links = std::move(other._hard_links);
+            _cache = std::move(other._cache);
+            _snapshot = std::move(other._snapshot);
+            _journal = std::move(other._journal);
+            _resumed = other._resumed;
+            _control = other._control;
+            _directories_reused = other._directories_reused;
+            _directories_read = other._directories_read;
+            _settle_time = other._settle_time;
+            _change_events = other._change_events;
+            _updates = other._updates;
+            _files_reexamined = other._files_reexamined;
+            _collected = nullptr;
+        }
+
+        void perform_scan(bool recurse) override;
+
+#if defined(OASIS_HAVE_FILE_WATCHER)
+        /**********************************************************************************************//**
+         * @fn	void duplicate_files_scanner::watch(bool recurse)
+         *
+         * @brief	Scans the search directory and then keeps the sets up to date as files are created,
+         * 			written, renamed and removed, until stop_watching() is called.
+         *
+         * 			Only the size groups a change touches are refined again: the old and new sizes of
+         * 			each changed file. Symbolic links are not followed by the updates.
+         *
+         * @exception	std::system_error	Thrown if the search directory cannot be watched, or the
+         * 									changes cannot be read.
+         *
+         * @param 	recurse	True to include the sub-directories.
+         **************************************************************************************************/
+
+        void watch(bool recurse);
+
+        // Makes a watch running on another thread return.
+        void stop_watching()
+        {
+            boost::lock_guard<boost::mutex> guard(_watch_lock);
+            if (_watcher) _watcher->stop();
+        }
+#endif
+
+    };
+
+    template<typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::perform_scan(bool recurse)
+    {
+        if (_scan_started_callback) _scan_started_callback(_search_dir);
+
+        // A scan replaces what the last one found. This comes before any file is added, resumed ones included, and
+        // the groups are left in place when the scan ends because watch() carries on from them.
+        _sets.clear();
+        _paths.clear();
+        _size_groups.clear();
+        _inodes.clear();
+        _hard_links.clear();
+        _files_encountered = 0;
+        _file_count = 0;
+        _space_occupied = 0;
+        _sets_found = 0;
+        _candidates = 0;
+        _files_hashed = 0;
+        _bytes_read = 0;
+        _eliminated_by_size = 0;
+        _eliminated_by_head = 0;
+        _eliminated_by_tail = 0;
+        _eliminated_by_full = 0;
+        _files_read_buffered = 0;
+        _files_read_io_uring = 0;
+        _files_read_mapped = 0;
+        _bytes_avoided = 0;
+        _directories_reused = 0;
+        _directories_read = 0;
+        _scan_started = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+        _pool = std::make_unique<thread_pool>(_hash_threads);
+        _buffers = std::make_unique<buffer_pool>(_read_buffer_size, static_cast<std::size_t>(_buffer_limit), _huge_pages);
+
+        // A resumed scan takes back the files that were found, while it walks the directories that were not finished.
+        std::vector<boost::filesystem::path> roots{ _search_dir };
+        std::vector<boost::filesystem::path> found;
+        _resumed = _journal && _journal->resumable(_search_dir, recurse, HashT::name());
+        if (_resumed)
+        {
+            roots = _journal->pending_directories();
+            found = _journal->files();
+            for (std::size_t first = 0; first < found.size(); first += 256)
+            {
+                _pool->submit([this, &found, first]()
+                {
+                    boost::system::error_code ec;
+                    for (std::size_t i = first; i < std::min<std::size_t>(first + 256, found.size()); i++)
+                    {
+                        if (!_checkpoint()) return;
+                        if (boost::filesystem::exists(found[i], ec)) _add_candidate(found[i]);
+                    }
+                });
+            }
+        }
+        else
+        {
+            _log([this, recurse](scan_journal& j) { j.start(_search_dir, recurse, HashT::name()); });
+            _log([this](scan_journal& j) { j.queue(_search_dir); });
+        }
+
+        try
+        {
+            _walk(roots, recurse);
+        }
+        catch (...)
+        {
+            // The hashing tasks already queued may refer to the files that were found, they finish before those go.
+            _pool.reset();
+            _buffers.reset();
+            throw;
+        }
+
+        // A cancelled walk did not reach every directory, and a resumed walk only the directories that were left, the
+        // listings of the others are kept for the next scan.
+        if (_snapshot && (_control->cancelled() || _resumed))
+        {
+            _snapshot->merge();
+        }
+        else if (_snapshot)
+        {
+            _snapshot->commit();
+        }
+
+        // Let the workers finish the head blocks queued during the traversal.
+        _pool->wait();
+
+        // Second pass, only files that share their size with at least one other file need to be refined.
+        _inodes.clear();
+        for (auto& sg : _size_groups)
+        {
+            if (!_checkpoint()) break;
+            _settle_group(sg.first, sg.second);
+        }
+
+        // Wait for threads.
+        _pool->wait();
+        _pool.reset();
+        _buffers.reset();
+        std::sort(_hard_links.begin(), _hard_links.end());
+        _flush_cache();
+
+        // A cancelled scan stays in the journal, to be resumed.
+        if (_control->cancelled())
+        {
+            _log([](scan_journal& j) { j.flush(); });
+        }
+        else
+        {
+            _log([](scan_journal& j) { j.complete(); });
+        }
+        if (_journal) _journal->release();
+
+        _tally();
+        _paths_kept = _paths.size();
+
+        if (_scan_completed_callback) _scan_completed_callback(_search_dir, _files_encountered, _file_count, _sets.size(), _space_occupied);
+    }
+
+    template<typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_walk(const std::vector<boost::filesystem::path>& roots, bool recurse)
+    {
+        // Walk the tree, the calling thread is always the first walker.
+        unsigned int walker_count = (_traversal_threads == 0) ? default_concurrency() : _traversal_threads;
+        _directories = std::make_unique<work_stealing_queue<_pending_directory>>(walker_count);
+        for (const auto& root : roots)
+        {
+            _directories->push(0, _pending_directory{ root, nullptr });
+        }
+        auto walk = [this, recurse](std::size_t worker, const _pending_directory& pending) { _process_directory(pending, recurse, worker); };
+
+        // A walker that fails stops and leaves its directories to the others. Every walker is joined before the first
+        // failure is passed on, as they all use the queue and this scanner.
+        std::vector<std::exception_ptr> failures(walker_count);
+        auto walker = [this, walk, &failures](std::size_t worker)
+        {
+            try
+            {
+                _directories->run(worker, walk);
+            }
+            catch (...)
+            {
+                failures[worker] = std::current_exception();
+            }
+        };
+        boost::thread_group walkers;
+        for (unsigned int i = 1; i < walker_count; i++)
+        {
+            try
+            {
+                walkers.create_thread([walker, i]() { walker(i); });
+            }
+            catch (const boost::thread_resource_error&)
+            {
+                break;
+            }
+        }
+        walker(0);
+        walkers.join_all();
+        _directories.reset();
+
+        for (const auto& failure : failures)
+        {
+            if (failure) std::rethrow_exception(failure);
+        }
+    }
+
+    template<typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_flush_cache()
+    {
+        if (!_cache) return;
+
+        try
+        {
+            _cache->flush();
+        }
+        catch (const std::system_error& e)
+        {
+            if (_scan_error_callback) _scan_error_callback(_cache->path().parent_path(), _cache->path(), e.code().default_error_condition());
+        }
+    }
+
+    template<typename SorterT, typename HashT>
+    bool duplicate_files_scanner<SorterT, HashT>::_checkpoint()
+    {
+        // Blocks while the scan is paused, with the spare buffers given back. Returns false once it has been cancelled.
+        if (!_control->interrupted()) return true;
+        if (_control->paused() && _buffers) _buffers->trim();
+
+        return _control->wait();
+    }
+
+    template<typename SorterT, typename HashT>
+    template <typename FuncT>
+    void duplicate_files_scanner<SorterT, HashT>::_log(FuncT record)
+    {
+        if (!_journal) return;
+
+        // The journal only saves work, failing to write to it must not stop the scan. It writes nothing more after a
+        // failure, so what it holds can still be resumed.
+        try
+        {
+            record(*_journal);
+        }
+        catch (const std::system_error& e)
+        {
+            if (_scan_error_callback) _scan_error_callback(_journal->path().parent_path(), _journal->path(), e.code().default_error_condition());
+        }
+    }
+
+    template<typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_queue_directory(const boost::filesystem::path& dir, std::size_t worker, std::shared_ptr<const directory_handle> parent)
+    {
+        // Once too many directories are held open, the sub-directories of the others are opened by their paths.
+        static constexpr unsigned int directory_budget = 256;
+
+        // A resumed walk leaves a directory that was queued before to the walker it was queued for.
+        bool queued = true;
+        _log([&dir, &queued](scan_journal& j) { queued = j.queue(dir); });
+        if (!queued) return;
+        if (_open_directories > directory_budget) parent.reset();
+        _directories->push(worker, _pending_directory{ dir, std::move(parent) });
+    }
+
+    template<typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_settle_group(uintmax_t file_size, std::deque<_candidate>& group)
+    {
+        for (auto& c : group)
+        {
+            if (!c.links.empty()) _collect_links(c);
+        }
+
+        if (group.size() == 1)
+        {
+            _eliminated_by_size++;
+
+            // A file with a unique size cannot have a duplicate, so it is only of interest when single entries are kept.
+            if (!_remove_single) _add_to_set(digest_key(file_size, nullptr, 0), group.front().path);
+            return;
+        }
+
+        _refine_group(file_size, group);
+    }
+
+    template<typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_tally()
+    {
+        // Work out the statistics, every key carries the size of the files in its set.
+        _sets.erase_if([this](const digest_index::set_type& k)
+        {
+            if (k.size == 1)
+            {
+                if (_remove_single) return true;
+                _file_count++;
+                _space_occupied += k.key.file_size();
+            }
+            else
+            {
+                _file_count += k.size - 1;
+                _space_occupied += (k.key.file_size() * (k.size - 1));
+            }
+            return false;
+        });
+
+        // The sets are packed and their members put in order once, rather than kept in order as they grow.
+        _sets.finish([this](path_store::id_type *first, std::size_t count) { _sort_members(first, count); });
+    }
+
+    template<typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_sort_members(path_store::id_type *first, std::size_t count)
+    {
+        // Each path is built once and the ids follow them, rather than building two paths for every comparison.
+        std::vector<std::pair<boost::filesystem::path, path_store::id_type>> members;
+        members.reserve(count);
+        for (std::size_t i = 0; i < count; i++)
+        {
+            members.emplace_back(_paths.path(first[i]), first[i]);
+        }
+        SorterT sorter;
+        std::stable_sort(members.begin(), members.end(), [&sorter](const auto& lhs, const auto& rhs) { return sorter(lhs.first, rhs.first); });
+        for (std::size_t i = 0; i < count; i++)
+        {
+            first[i] = members[i].second;
+        }
+    }
+
+    template<typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_compact_paths()
+    {
+        // The store never lets go of a path, and every batch of changes adds the files it looks at, including ones that
+        // are gone by the next batch. Once it has doubled it is built again from the members of the sets alone, which
+        // keeps their order since the paths are the same.
+        if (_paths.size() <= _paths_kept * 2) return;
+
+        // The new ids are all worked out before any is put in place, so running out of memory leaves the sets as they were.
+        path_store paths;
+        std::vector<path_store::id_type> ids;
+        for (const auto& set : _sets)
+        {
+            for (auto id : _sets.members(set))
+            {
+                ids.push_back(paths.add(_paths.path(id)));
+            }
+        }
+        auto next = ids.begin();
+        _sets.remap([&next](path_store::id_type) { return *next++; });
+        _paths = std::move(paths);
+        _paths_kept = _paths.size();
+    }
+
+#if defined(OASIS_HAVE_FILE_WATCHER)
+    template<typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::watch(bool recurse)
+    {
+        {
+            boost::lock_guard<boost::mutex> guard(_watch_lock);
+            _watcher = std::make_shared<file_watcher>(_search_dir, recurse, _skip_hidden, [this](const boost::filesystem::path& p, const std::error_condition& e)
+            {
+                if (_scan_error_callback) _scan_error_callback(_search_dir, p, e);
+            });
+        }
+
+        struct pending_change
+        {
+            std::chrono::steady_clock::time_point last;
+            bool directory = false;
+        };
+
+        try
+        {
+            // The watcher is started first, so changes made during the scan are queued and applied after it.
+            perform_scan(recurse);
+            if (_control->cancelled()) _watcher->stop();
+            _watched.clear();
+            for (const auto& sg : _size_groups)
+            {
+                for (const auto& c : sg.second)
+                {
+                    _watched[c.path] = sg.first;
+                }
+            }
+            for (const auto& links : _hard_links)
+            {
+                auto file_size = _watched[links.front()];
+                for (const auto& p : links)
+                {
+                    _watched[p] = file_size;
+                }
+            }
+
+            // Each path waits until it has been quiet for the settle time, then every path that is ready is applied
+            // as one batch.
+            std::map<boost::filesystem::path, pending_change> pending;
+            std::vector<file_change> changes;
+            for (;;)
+            {
+                auto now = std::chrono::steady_clock::now();
+                auto timeout = std::chrono::milliseconds(-1);
+                if (!pending.empty())
+                {
+                    auto oldest = now;
+                    for (const auto& p : pending)
+                    {
+                        oldest = std::min(oldest, p.second.last);
+                    }
+                    timeout = std::max(std::chrono::milliseconds(0), std::chrono::duration_cast<std::chrono::milliseconds>(oldest + _settle_time - now) + std::chrono::milliseconds(1));
+                }
+
+                changes.clear();
+                if (!_watcher->wait(changes, timeout)) break;
+                now = std::chrono::steady_clock::now();
+                _change_events += changes.size();
+                for (const auto& c : changes)
+                {
+                    auto& p = pending[c.path];
+                    p.last = now;
+                    p.directory = p.directory || c.directory;
+                }
+
+                std::set<boost::filesystem::path> files, dirs;
+                for (auto it = pending.begin(); it != pending.end();)
+                {
+                    if (now - it->second.last < _settle_time)
+                    {
+                        ++it;
+                        continue;
+                    }
+                    if (it->second.directory)
+                    {
+                        dirs.insert(it->first);
+                    }
+                    else
+                    {
+                        files.insert(it->first);
+                    }
+                    it = pending.erase(it);
+                }
+                if (!files.empty() || !dirs.empty()) _apply_changes(files, dirs, recurse);
+                if (_control->cancelled()) break;
+            }
+        }
+        catch (...)
+        {
+            boost::lock_guard<boost::mutex> guard(_watch_lock);
+            _watcher.reset();
+            throw;
+        }
+
+        boost::lock_guard<boost::mutex> guard(_watch_lock);
+        _watcher.reset();
+    }
+#endif
+
+    template<typename SorterT, typename HashT>
+    bool duplicate_files_scanner<SorterT, HashT>::_in_scope(const boost::filesystem::path& p, bool recurse)
+    {
+        // Whether a walk of the search directory would reach the path.
+        auto relative = p.lexically_relative(_search_dir);
+        if (relative.empty() || (*relative.begin() == "..")) return false;
+        if (relative == ".") return true;
+        if (!recurse && (std::distance(relative.begin(), relative.end()) > 1)) return false;
+        if (!_skip_hidden) return true;
+
+        boost::system::error_code ec;
+        auto q = _search_dir;
+        for (const auto& e : relative)
+        {
+            q /= e;
+            if (is_hidden(q, ec)) return false;
+        }
+
+        return true;
+    }
+
+    template<typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_apply_changes(const std::set<boost::filesystem::path>& files, const std::set<boost::filesystem::path>& dirs, bool recurse)
+    {
+        boost::system::error_code ec;
+        _pool = std::make_unique<thread_pool>(_hash_threads);
+        _buffers = std::make_unique<buffer_pool>(_read_buffer_size, static_cast<std::size_t>(_buffer_limit), _huge_pages);
+
+        // The journal records a scan, not the updates that follow it.
+        auto journal = std::move(_journal);
+        _resumed = false;
+
+        // Every known file below a directory that changed may have gone, and the directory is walked again for files
+        // that have arrived. The walk only gathers them, and leaves the snapshot alone.
+        std::set<boost::filesystem::path> paths(files);
+        std::vector<boost::filesystem::path> roots;
+        for (const auto& d : dirs)
+        {
+            for (auto it = _watched.lower_bound(d); (it != _watched.end()) && is_within(it->first, d); ++it)
+            {
+                paths.insert(it->first);
+            }
+            if (((d == _search_dir) || (recurse && _in_scope(d, recurse))) && boost::filesystem::is_directory(boost::filesystem::symlink_status(d, ec))) roots.push_back(d);
+        }
+        if (!roots.empty())
+        {
+            std::vector<boost::filesystem::path> found;
+            auto snapshot = std::move(_snapshot);
+            _collected = &found;
+            try
+            {
+                _walk(roots, recurse);
+            }
+            catch (...)
+            {
+                _collected = nullptr;
+                _snapshot = std::move(snapshot);
+                _journal = std::move(journal);
+                _pool.reset();
+                _buffers.reset();
+                throw;
+            }
+            _collected = nullptr;
+            _snapshot = std::move(snapshot);
+            paths.insert(found.begin(), found.end());
+        }
+
+        // A changed file affects the group of the size it had, and of the size it has now.
+        std::set<uintmax_t> sizes;
+        std::vector<boost::filesystem::path> arrived;
+        for (const auto& p : paths)
+        {
+            auto known = _watched.find(p);
+            if (known != _watched.end()) sizes.insert(known->second);
+            if (!_in_scope(p, recurse)) continue;
+            auto status = boost::filesystem::symlink_status(p, ec);
+            if (ec || !boost::filesystem::is_regular_file(status)) continue;
+            auto file_size = boost::filesystem::file_size(p, ec);
+            if (ec || (file_size < _min_size) || (file_size > _max_size)) continue;
+            sizes.insert(file_size);
+            arrived.push_back(p);
+        }
+
+        // Take apart the groups of those sizes, with their sets and hard links, and build them again.
+        std::vector<boost::filesystem::path> kept;
+        for (auto it = _hard_links.begin(); it != _hard_links.end();)
+        {
+            auto known = _watched.find(it->front());
+            if ((known == _watched.end()) || !sizes.contains(known->second))
+            {
+                ++it;
+                continue;
+            }
+            for (const auto& p : *it)
+            {
+                if (!paths.contains(p)) kept.push_back(p);
+            }
+            it = _hard_links.erase(it);
+        }
+        for (auto file_size : sizes)
+        {
+            auto group = _size_groups.find(file_size);
+            if (group != _size_groups.end())
+            {
+                for (const auto& c : group->second)
+                {
+                    if (!paths.contains(c.path)) kept.push_back(c.path);
+                }
+                _size_groups.erase(group);
+            }
+        }
+
+        // The index is not ordered by size, so one pass over it takes apart the sets of all of the sizes.
+        _sets.erase_if([this, &sizes](const digest_index::set_type& k)
+        {
+            if (!sizes.contains(k.key.file_size())) return false;
+            if (k.size > 1)
+            {
+                _sets_found--;
+                boost::lock_guard<boost::mutex> guard(_set_callback_lock);
+                if (_set_callback) _set_callback(set_event::dissolved, k.key, {});
+            }
+            return true;
+        });
+        for (const auto& p : paths)
+        {
+            _watched.erase(p);
+        }
+        std::sort(kept.begin(), kept.end());
+        kept.erase(std::unique(kept.begin(), kept.end()), kept.end());
+
+        _inodes.clear();
+        for (const auto& p : kept)
+        {
+            _add_candidate(p);
+        }
+        for (const auto& p : arrived)
+        {
+            _consider_file(p);
+        }
+        _pool->wait();
+        _inodes.clear();
+
+        for (auto file_size : sizes)
+        {
+            auto group = _size_groups.find(file_size);
+            if (group == _size_groups.end()) continue;
+            if (!_checkpoint()) break;
+            auto links = _hard_links.size();
+            _settle_group(file_size, group->second);
+            for (const auto& c : group->second)
+            {
+                _watched[c.path] = file_size;
+            }
+            for (auto i = links; i < _hard_links.size(); i++)
+            {
+                for (const auto& p : _hard_links[i])
+                {
+                    _watched[p] = file_size;
+                }
+            }
+        }
+
+        _pool->wait();
+        _pool.reset();
+        _buffers.reset();
+        std::sort(_hard_links.begin(), _hard_links.end());
+        _flush_cache();
+        _journal = std::move(journal);
+
+        _file_count = 0;
+        _space_occupied = 0;
+        _tally();
+        _compact_paths();
+        _updates++;
+        _files_reexamined += kept.size() + arrived.size();
+
+        if (_sets_updated_callback) _sets_updated_callback(_search_dir, kept.size() + arrived.size(), _file_count, _sets.size(), _space_occupied);
+    }
+
+    template<typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_process_directory(const _pending_directory& pending, bool recurse, std::size_t worker)
+    {
+        // A directory changed this close to the start of the scan may change again without its times moving on
+        // file systems with coarse timestamps, so it is read but not kept in the snapshot.
+        static constexpr int64_t settle_time = 2000000000;
+        if (!_checkpoint()) return;
+
+        const auto& dir = pending.path;
+        boost::system::error_code ec;
+        auto handle = _open_directory(pending, ec);
+        if (ec)
+        {
+            if (_scan_error_callback) _scan_error_callback(_search_dir, (dir == _search_dir) ? boost::filesystem::path() : dir, ec.default_error_condition());
+            if (!_control->cancelled()) _log([&dir](scan_journal& j) { j.finish(dir); });
+            return;
+        }
+
+        std::shared_ptr<directory_snapshot::listing> listing;
+        if (_snapshot)
+        {
+            uintmax_t size = 0;
+            file_times times;
+#if defined(__linux__)
+            auto id = handle ? identity(handle->fd(), size, times, ec) : identity(dir, size, times, ec);
+#else
+            auto id = identity(dir, size, times, ec);
+#endif
+            if (!ec)
+            {
+                auto known = _snapshot->find(dir, id, times);
+                if (known)
+                {
+                    _counter_lock.lock();
+                    _directories_reused++;
+                    _counter_lock.unlock();
+                    _snapshot->record(dir, known);
+                    auto parent = handle ? handle : std::make_shared<const directory_handle>(known->canonical, -1);
+                    for (const auto& e : known->entries)
+                    {
+                        if (_control->cancelled()) break;
+                        if (_skip_hidden && e.hidden) continue;
+                        switch (e.kind)
+                        {
+                            case directory_snapshot::entry_kind::directory:
+                                if (recurse) _queue_directory(known->canonical / e.name, worker, handle);
+                                break;
+                            case directory_snapshot::entry_kind::file:
+                            {
+                                // The file is examined once, by its name in the open directory where there is one. One
+                                // that cannot be examined is left for _add_candidate() to report.
+                                directory_entry entry(parent, e.name.native());
+                                const auto& status = entry.status(ec);
+                                ec.clear();
+                                if (!status.valid) _consider_file(entry.path());
+                                else if ((entry.type() == entry_type::file) || (entry.type() == entry_type::unknown)) _consider_file(entry.path(), &status);
+                                break;
+                            }
+                            default:
+                                _process_filesystem_entry(directory_entry(parent, e.name.native()), recurse, worker, nullptr, handle != nullptr);
+                                break;
+                        }
+                    }
+                    if (!_control->cancelled()) _log([&dir](scan_journal& j) { j.finish(dir); });
+                    return;
+                }
+
+                if ((times.modified < _scan_started - settle_time) && (times.changed < _scan_started - settle_time))
+                {
+                    listing = std::make_shared<directory_snapshot::listing>();
+                    listing->id = id;
+                    listing->times = times;
+                    // A directory opened relative to its parent was reached through no links, its path is canonical.
+                    listing->canonical = handle ? dir : boost::filesystem::canonical(dir, ec);
+                    if (ec) listing.reset();
+                }
+            }
+            ec.clear();
+        }
+
+        _counter_lock.lock();
+        _directories_read++;
+        _counter_lock.unlock();
+
+        // Entries that could not be examined leave the listing incomplete, it is not kept.
+        bool complete = true;
+        try
+        {
+            // The names are all read first, so the directory is not held open while the walker waits on the hashing
+            // threads, or on a paused scan.
+            std::vector<directory_entry> entries;
+            {
+#if defined(__linux__)
+                auto de = handle ? directory_enumerator(handle) : directory_enumerator(dir);
+#else
+                directory_enumerator de(dir);
+#endif
+                while (de.move_next(ec))
+                {
+                    entries.push_back(de.entry());
+                }
+            }
+            for (const auto& e : entries)
+            {
+                if (_control->cancelled())
+                {
+                    complete = false;
+                    break;
+                }
+                if (!_process_filesystem_entry(e, recurse, worker, listing.get(), handle != nullptr)) complete = false;
+            }
+        }
+        catch (const boost::filesystem::filesystem_error& e)
+        {
+            ec = e.code();
+        }
+        catch (const std::system_error& e)
+        {
+            ec = boost::system::error_code(e.code().value(), boost::system::generic_category());
+        }
+
+        if (ec && _scan_error_callback) _scan_error_callback(_search_dir, (dir == _search_dir) ? boost::filesystem::path() : dir, ec.default_error_condition());
+        if (listing && complete && !ec) _snapshot->record(dir, std::move(listing));
+        if (!_control->cancelled()) _log([&dir](scan_journal& j) { j.finish(dir); });
+    }
+
+    template<typename SorterT, typename HashT>
+    std::shared_ptr<const directory_handle> duplicate_files_scanner<SorterT, HashT>::_open_directory(const _pending_directory& pending, boost::system::error_code& ec)
+    {
+        ec.clear();
+#if defined(__linux__)
+        if (!_relative_traversal) return nullptr;
+
+        // A sub-directory is opened by its name in its parent, and must still be a directory rather than a link that
+        // has replaced it since it was examined.
+        const auto& path = pending.path.native();
+        int fd = -1;
+        for (;;)
+        {
+            if (pending.parent)
+            {
+                fd = ::openat(pending.parent->fd(), path.c_str() + path.rfind('/') + 1, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            }
+            else
+            {
+                fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            }
+            if (fd >= 0) break;
+            if (errno == EINTR) continue;
+            if ((errno == ENFILE) || (errno == EMFILE) || (errno == ENOMEM))
+            {
+                boost::this_thread::sleep_for(boost::chrono::seconds(5));
+                continue;
+            }
+            ec = boost::system::error_code(errno, boost::system::generic_category());
+            return nullptr;
+        }
+
+        // Counted until the last sub-directory that needs it has been opened.
+        _open_directories++;
+        return std::shared_ptr<const directory_handle>(new directory_handle(pending.path, fd), [this](const directory_handle *h)
+        {
+            delete h;
+            _open_directories--;
+        });
+#else
+        return nullptr;
+#endif
+    }
+
+    template<typename SorterT, typename HashT>
+    bool duplicate_files_scanner<SorterT, HashT>::_process_filesystem_entry(const directory_entry& entry, bool recurse, std::size_t worker, directory_snapshot::listing *listing, bool relative)
+    {
+        boost::system::error_code ec;
+        auto dirent = entry.path();
+        boost::filesystem::path p;
+        const entry_status *status = nullptr;
+        bool hidden = false, symlink = false, known = false, directory = false, regular = false;
+#if defined(__linux__)
+        if (relative)
+        {
+            // The type recorded in the directory is enough for everything but a regular file, which is examined once by
+            // its name in the open directory, and whatever that finds travels with it. Hidden entries that are skipped
+            // are not examined at all.
+            hidden = entry.dot_file();
+            if (!(_skip_hidden && hidden) && ((entry.type() == entry_type::file) || (entry.type() == entry_type::unknown)))
+            {
+                status = &entry.status(ec);
+                if (ec)
+                {
+                    if (_scan_error_callback) _scan_error_callback(_search_dir, dirent, ec.default_error_condition());
+                    return false;
+                }
+            }
+            symlink = (entry.type() == entry_type::symlink);
+            known = !symlink;
+            directory = (entry.type() == entry_type::directory);
+            regular = (entry.type() == entry_type::file);
+        }
+        else
+#endif
+        {
+            hidden = is_hidden(dirent, ec);
+            if (ec)
+            {
+                if (_scan_error_callback) _scan_error_callback(_search_dir, dirent, ec.default_error_condition());
+                return false;
+            }
+            symlink = boost::filesystem::is_symlink(dirent, ec);
+            if (ec)
+            {
+                if (_scan_error_callback) _scan_error_callback(_search_dir, dirent, ec.default_error_condition());
+                return false;
+            }
+        }
+
+        // Links are resolved again by every scan, as their targets can change without the directory changing.
+        if (listing && (symlink || (_skip_hidden && hidden))) listing->entries.push_back({ boost::filesystem::path(entry.name()), directory_snapshot::entry_kind::other, hidden });
+        if (_skip_hidden && hidden) return true;
+
+        if (symlink)
+        {
+            if (_follow_links)
+            {
+                p = boost::filesystem::canonical(dirent, ec);
+                if (ec)
+                {
+                    if (_scan_error_callback) _scan_error_callback(_search_dir, dirent, ec.default_error_condition());
+                    return false;
+                }
+            }
+            else
+            {
+                return true;
+            }
+        }
+        else if (known)
+        {
+            // The entries of an open directory are named from its canonical path, and this one is not a link.
+            p = dirent;
+        }
+        else
+        {
+            p = boost::filesystem::canonical(dirent, ec);
+            if (ec)
+            {
+                if (_scan_error_callback) _scan_error_callback(_search_dir, dirent, ec.default_error_condition());
+                return false;
+            }
+        }
+
+        if (!known)
+        {
+            if (!boost::filesystem::exists(p, ec) && !ec) return true;
+            if (ec)
+            {
+                if (_scan_error_callback) _scan_error_callback(_search_dir, p, ec.default_error_condition());
+                return false;
+            }
+            directory = boost::filesystem::is_directory(p, ec);
+            if (ec)
+            {
+                if (_scan_error_callback) _scan_error_callback(_search_dir, p, ec.default_error_condition());
+                return false;
+            }
+            regular = !directory && boost::filesystem::is_regular_file(p, ec);
+            if (ec)
+            {
+                if (_scan_error_callback) _scan_error_callback(_search_dir, p, ec.default_error_condition());
+                return false;
+            }
+        }
+
+        // ---------------------------------------------------------------------------------------------------------
+        // Directory.
+        // ---------------------------------------------------------------------------------------------------------
+        if (directory)
+        {
+            // Queue the sub-directory, any idle walker may pick it up. A directory reached through a link is opened by
+            // its resolved path.
+            if (listing && !symlink) listing->entries.push_back({ boost::filesystem::path(entry.name()), directory_snapshot::entry_kind::directory, hidden });
+            if (recurse) _queue_directory(p, worker, (relative && !symlink) ? entry.parent() : nullptr);
+            return true;
+        }
+
+        // ---------------------------------------------------------------------------------------------------------
+        // File.
+        // ---------------------------------------------------------------------------------------------------------
+        if (!regular) return true;
+
+        if (listing && !symlink) listing->entries.push_back({ boost::filesystem::path(entry.name()), directory_snapshot::entry_kind::file, hidden });
+        _consider_file(p, status);
+        return true;
+    }
+
+    template<typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_consider_file(const boost::filesystem::path& p, const entry_status *status)
+    {
+        if (!_extensions.empty())
+        {
+            std::cout << "EXTENSIONS NOT EMPTY!!" << std::endl;
+            auto e = p.extension().string();
+            if (!_extensions.contains(e)) return;
+        }
+
+        // While a watch walks a directory that changed, the files are only gathered.
+        if (_collected != nullptr)
+        {
+            boost::lock_guard<boost::mutex> list(_list_lock);
+            _collected->push_back(p);
+            return;
+        }
+
+        _log([&p](scan_journal& j) { j.add_file(p); });
+        _add_candidate(p, status);
+    }
+
+    template <typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_add_candidate(const boost::filesystem::path& p, const entry_status *status)
+    {
+        boost::system::error_code ec;
+        _counter_lock.lock();
+        auto examined = ++_files_encountered;
+        _counter_lock.unlock();
+
+        // A file the walker has already examined is not examined again.
+        uintmax_t file_size = 0;
+        file_times times;
+        file_identity id;
+        if (status != nullptr)
+        {
+            id = status->id;
+            file_size = status->size;
+            times = status->times;
+        }
+        else
+        {
+            id = identity(p, file_size, times, ec);
+        }
+        if (ec)
+        {
+            if (_scan_error_callback) _scan_error_callback(p.parent_path(), p, ec.default_error_condition());
+            return;
+        }
+        if ((file_size < _min_size) || (file_size > _max_size)) return;
+
+        // A resumed scan has the digests of the files that were read before it was interrupted, and have not changed.
+        digest_key full, head;
+        bool cached = (file_size != 0) && (_strategy != comparison_strategy::lockstep) && id.known() && ((_resumed && _journal->find_digest(id, file_size, times, full)) || (_cache && _cache->find(id, file_size, times, full)));
+        bool head_known = (file_size > _block_size) && (_strategy != comparison_strategy::lockstep) && id.known() && _resumed && _journal->find_head(id, file_size, times, head);
+
+        // As soon as a second file of the same size turns up, both can start being hashed.
+        _candidate *first = nullptr;
+        _candidate *second = nullptr;
+        boost::unique_lock<boost::mutex> list(_list_lock);
+        if (id.known())
+        {
+            // Another link to a file that has already been found, its data only needs to be read once.
+            auto known = _inodes.find(id);
+            if (known != _inodes.end())
+            {
+                if (known->second->path != p) known->second->links.push_back(p);
+                auto candidates = _candidates;
+                list.unlock();
+                if (_enumeration_progress_callback) _enumeration_progress_callback(p.parent_path(), examined, candidates);
+                return;
+            }
+        }
+        auto& group = _size_groups[file_size];
+        group.emplace_back();
+        group.back().path = p;
+        group.back().id = id;
+        group.back().times = times;
+        group.back().cached = cached;
+        group.back().full = full;
+        group.back().head = head;
+        group.back().valid = head_known;
+        if (id.known()) _inodes.emplace(id, &group.back());
+        if (group.size() == 2)
+        {
+            _candidates += 2;
+            first = &group.front();
+            second = &group.back();
+        }
+        else if (group.size() > 2)
+        {
+            _candidates++;
+            second = &group.back();
+        }
+        auto candidates = _candidates;
+        list.unlock();
+
+        if (_strategy != comparison_strategy::lockstep)
+        {
+            if (first != nullptr) _hash_head(file_size, first);
+            if (second != nullptr) _hash_head(file_size, second);
+        }
+        if (_enumeration_progress_callback) _enumeration_progress_callback(p.parent_path(), examined, candidates);
+    }
+
+    template <typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_hash_head(uintmax_t file_size, _candidate *c)
+    {
+        // Zero byte files are all identical, there is nothing to read, and the cache or the journal already know the
+        // digest of the file or of its head.
+        if ((file_size == 0) || c->cached || c->valid) return;
+
+        uintmax_t length = (file_size <= _block_size) ? file_size : _block_size;
+        _pool->submit([this, file_size, length, c]()
+        {
+            if (!_checkpoint()) return;
+            _counter_lock.lock();
+            _files_hashed++;
+            _counter_lock.unlock();
+
+            c->valid = _digest_range(c->path, file_size, 0, length, c->head);
+            if (c->valid && (file_size > _block_size)) _log([c, file_size](scan_journal& j) { j.store_head(c->id, file_size, c->times, c->head); });
+            _report_progress(c->path);
+        });
+    }
+
+    template <typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_collect_links(_candidate& c)
+    {
+        // The walkers find the links in no particular order, the first path in order stands for all of them.
+        std::vector<boost::filesystem::path> group = std::move(c.links);
+        group.push_back(c.path);
+        std::sort(group.begin(), group.end());
+        group.erase(std::unique(group.begin(), group.end()), group.end());
+        c.path = group.front();
+        c.links.clear();
+        if (group.size() > 1) _hard_links.push_back(std::move(group));
+    }
+
+    template <typename SorterT, typename HashT>
+    typename duplicate_files_scanner<SorterT, HashT>::_stamp duplicate_files_scanner<SorterT, HashT>::_take_stamp(const boost::filesystem::path& p)
+    {
+        // Taken before the file is read, so a change made while it is being read leaves the cached digest stale.
+        _stamp stamp;
+        if (!_cache && !_journal) return stamp;
+
+        boost::system::error_code ec;
+        stamp.id = identity(p, stamp.size, stamp.times, ec);
+        stamp.valid = !ec && stamp.id.known();
+        return stamp;
+    }
+
+    template <typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_remember(const _stamp& stamp, const digest_key& key)
+    {
+        // A file that changed size since it was enumerated was not read to its end, its digest is not worth keeping.
+        if (!stamp.valid || (stamp.size != key.file_size())) return;
+        _log([&stamp, &key](scan_journal& j) { j.store_digest(stamp.id, stamp.size, stamp.times, key); });
+        if (!_cache) return;
+
+        // The cache only saves work, failing to write to it must not stop the scan.
+        try
+        {
+            _cache->store(stamp.id, stamp.size, stamp.times, key);
+        }
+        catch (const std::system_error& e)
+        {
+            if (_scan_error_callback) _scan_error_callback(_cache->path().parent_path(), _cache->path(), e.code().default_error_condition());
+        }
+    }
+
+    template <typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_refine_group(uintmax_t file_size, std::deque<_candidate>& members)
+    {
+        // The walkers find files in no particular order, sort them so every scan of the same tree builds the same sets.
+        std::sort(members.begin(), members.end(), [](const _candidate& lhs, const _candidate& rhs) { return lhs.path < rhs.path; });
+
+        // Zero byte files are all identical.
+        if (file_size == 0)
+        {
+            for (const auto& c : members)
+            {
+                _add_to_set(digest_key(), c.path);
+            }
+            return;
+        }
+
+        if (_strategy == comparison_strategy::lockstep)
+        {
+            std::vector<boost::filesystem::path> paths;
+            paths.reserve(members.size());
+            for (const auto& c : members)
+            {
+                paths.push_back(c.path);
+            }
+            _pool->submit([this, file_size, paths = std::move(paths)]() mutable { _compare_group(file_size, std::move(paths), 0); });
+            return;
+        }
+
+        // If the head block covers the whole file, its digest is the digest of the file.
+        bool whole = (file_size <= _block_size);
+        bool any_cached = std::any_of(members.begin(), members.end(), [](const _candidate& c) { return c.cached; });
+        if (whole)
+        {
+            for (auto& c : members)
+            {
+                if (c.cached)
+                {
+                    c.head = c.full;
+                    c.valid = true;
+                }
+                else if (c.valid)
+                {
+                    _remember(_stamp{ c.id, file_size, c.times, c.id.known() }, c.head);
+                }
+            }
+        }
+        else if (any_cached && !std::all_of(members.begin(), members.end(), [](const _candidate& c) { return c.valid; }))
+        {
+            // Cached digests are of whole files, so the other members are hashed in full to be compared with them.
+            auto g = std::make_shared<_group>();
+            g->file_size = file_size;
+            g->stage = _stage::full;
+            for (const auto& c : members)
+            {
+                if (c.cached)
+                {
+                    g->cached.emplace_back(c.full, c.path);
+                }
+                else if (c.valid)
+                {
+                    g->members.push_back(c.path);
+                }
+            }
+            if (g->members.empty())
+            {
+                _complete(g);
+            }
+            else
+            {
+                _dispatch(g);
+            }
+            return;
+        }
+
+        std::unordered_map<digest_key, std::vector<const _candidate *>> heads;
+        for (const auto& c : members)
+        {
+            if (c.valid) heads[c.head].push_back(&c);
+        }
+
+        for (auto& hp : heads)
+        {
+            if (hp.second.size() == 1)
+            {
+                _eliminated_by_head++;
+                if (!_remove_single) _add_to_set(hp.first, hp.second.front()->path);
+                continue;
+            }
+            if (whole)
+            {
+                for (const auto c : hp.second)
+                {
+                    _add_to_set(hp.first, c->path);
+                }
+                continue;
+            }
+
+            // Members whose heads came from the journal of a resumed scan may also have their whole digests, the
+            // others are then hashed in full to be compared with them.
+            auto g = std::make_shared<_group>();
+            g->file_size = file_size;
+            g->stage = std::any_of(hp.second.begin(), hp.second.end(), [](const _candidate *c) { return c->cached; }) ? _stage::full : _stage::tail;
+            g->head = hp.first;
+            for (const auto c : hp.second)
+            {
+                if ((g->stage == _stage::full) && c->cached)
+                {
+                    g->cached.emplace_back(c->full, c->path);
+                }
+                else
+                {
+                    g->members.push_back(c->path);
+                }
+            }
+            if (g->members.empty())
+            {
+                _complete(g);
+            }
+            else
+            {
+                _dispatch(g);
+            }
+        }
+    }
+
+    template <typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_dispatch(const std::shared_ptr<_group>& g)
+    {
+        if (_control->cancelled()) return;
+        auto count = g->members.size();
+        g->keys.resize(count);
+        g->valid.assign(count, 0);
+        g->pending = count;
+
+        if (g->stage == _stage::progressive)
+        {
+            while (g->hashers.size() < count) g->hashers.push_back(std::make_unique<HashT>());
+            g->stamps.resize(count);
+            g->length = std::min(g->chunk, g->file_size - g->position);
+            for (std::size_t i = 0; i < count; i++)
+            {
+                _pool->submit([this, g, i]()
+                {
+                    if (_checkpoint())
+                    {
+                        if (g->position == 0) g->stamps[i] = _take_stamp(g->members[i]);
+                        g->valid[i] = _feed_range(g->members[i], g->position, g->length, *g->hashers[i]);
+                        _report_progress(g->members[i]);
+                    }
+                    if (g->pending.fetch_sub(1) == 1) _complete(g);
+                });
+            }
+            return;
+        }
+
+        uintmax_t offset = (g->stage == _stage::tail) ? (g->file_size - _block_size) : 0;
+        uintmax_t length = (g->stage == _stage::tail) ? _block_size : g->file_size;
+        if (_use_io_uring())
+        {
+            // Each task keeps a batch of files in flight on the ring of its worker.
+            for (std::size_t first = 0; first < count; first += _queue_depth)
+            {
+                std::size_t batch = std::min<std::size_t>(_queue_depth, count - first);
+                _pool->submit([this, g, first, batch, offset, length]() { _digest_batch(g, first, batch, offset, length); });
+            }
+            return;
+        }
+
+        for (std::size_t i = 0; i < count; i++)
+        {
+            _pool->submit([this, g, i, offset, length]()
+            {
+                if (_checkpoint())
+                {
+                    _stamp stamp;
+                    if (g->stage == _stage::full) stamp = _take_stamp(g->members[i]);
+                    g->valid[i] = _digest_range(g->members[i], g->file_size, offset, length, g->keys[i]);
+                    if (g->valid[i]) _remember(stamp, g->keys[i]);
+                    _report_progress(g->members[i]);
+                }
+                if (g->pending.fetch_sub(1) == 1) _complete(g);
+            });
+        }
+    }
+
+    template <typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_complete(const std::shared_ptr<_group>& g)
+    {
+        // Some members of a group completed after a cancellation were not read, nothing can be said about the others.
+        if (_control->cancelled()) return;
+        if (g->stage == _stage::progressive)
+        {
+            _complete_round(g);
+            return;
+        }
+
+        partition_t parts;
+        for (std::size_t i = 0; i < g->members.size(); i++)
+        {
+            if (g->valid[i]) parts[g->keys[i]].push_back(std::move(g->members[i]));
+        }
+        for (auto& c : g->cached)
+        {
+            parts[c.first].push_back(std::move(c.second));
+        }
+
+        for (auto& part : parts)
+        {
+            if (g->stage == _stage::tail)
+            {
+                if (part.second.size() == 1)
+                {
+                    _counter_lock.lock();
+                    _eliminated_by_tail++;
+                    _counter_lock.unlock();
+                    if (!_remove_single) _add_to_set(_combine_keys(g->head, part.first), part.second.front());
+                    continue;
+                }
+
+                // Only files that agree at both ends are streamed in full. A file no longer than a digest is its own
+                // key, the same under every strategy and in the hash cache, so it is never read progressively.
+                auto next = std::make_shared<_group>();
+                next->file_size = g->file_size;
+                next->stage = ((_strategy == comparison_strategy::progressive) && (g->file_size > HashT::digest_size)) ? _stage::progressive : _stage::full;
+                next->head = g->head;
+                next->members = std::move(part.second);
+                next->chunk = _progressive_chunk;
+                _dispatch(next);
+            }
+            else
+            {
+                if (part.second.size() == 1)
+                {
+                    _counter_lock.lock();
+                    _eliminated_by_full++;
+                    _counter_lock.unlock();
+                    if (_remove_single) continue;
+                }
+                for (const auto& p : part.second)
+                {
+                    _add_to_set(part.first, p);
+                }
+            }
+        }
+    }
+
+    template <typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_complete_round(const std::shared_ptr<_group>& g)
+    {
+        // Regroup on the digest of everything read so far, after the last round that is the digest of the whole file.
+        g->position += g->length;
+        bool last = (g->position == g->file_size);
+        std::unordered_map<digest_key, std::vector<std::size_t>> parts;
+        for (std::size_t i = 0; i < g->members.size(); i++)
+        {
+            if (!g->valid[i]) continue;
+            uint8_t digest[HashT::digest_size];
+            if (last)
+            {
+                g->hashers[i]->finish(digest);
+            }
+            else
+            {
+                g->hashers[i]->peek(digest);
+            }
+            parts[digest_key(g->file_size, digest, HashT::digest_size)].push_back(i);
+        }
+
+        for (auto& part : parts)
+        {
+            if (part.second.size() == 1)
+            {
+                _counter_lock.lock();
+                _eliminated_by_full++;
+                _bytes_avoided += g->file_size - g->position;
+                _counter_lock.unlock();
+                if (!_remove_single) _add_to_set(part.first, g->members[part.second.front()]);
+                continue;
+            }
+
+            if (last)
+            {
+                for (auto i : part.second)
+                {
+                    _remember(g->stamps[i], part.first);
+                    _add_to_set(part.first, g->members[i]);
+                }
+                continue;
+            }
+
+            auto next = std::make_shared<_group>();
+            next->file_size = g->file_size;
+            next->stage = _stage::progressive;
+            next->head = g->head;
+            next->position = g->position;
+            next->chunk = g->chunk * 4;
+            for (auto i : part.second)
+            {
+                next->members.push_back(std::move(g->members[i]));
+                next->hashers.push_back(std::move(g->hashers[i]));
+                next->stamps.push_back(g->stamps[i]);
+            }
+            _dispatch(next);
+        }
+    }
+
+    template <typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_report_progress(const boost::filesystem::path& p)
+    {
+        if (!_scan_progress_callback) return;
+
+        _counter_lock.lock();
+        auto hashed = _files_hashed;
+        _counter_lock.unlock();
+        _list_lock.lock();
+        auto found = _sets_found;
+        _list_lock.unlock();
+
+        _scan_progress_callback(p.parent_path(), hashed, found);
+    }
+
+    template <typename SorterT, typename HashT>
+    bool duplicate_files_scanner<SorterT, HashT>::_digest_range(const boost::filesystem::path& p, uintmax_t file_size, uintmax_t offset, uintmax_t length, digest_key& key)
+    {
+        uint8_t digest[HashT::digest_size];
+
+        if (length <= HashT::digest_size) // If the data will fit inside the hash buffer then we can save a pointless hashing operation.
+        {
+            FILE *file = _open_at(p, offset);
+            if (file == nullptr) return false;
+            auto bytes_read = fread(digest, 1, length, file);
+            if (bytes_read != length)
+            {
+                auto ec = boost::system::error_code(errno, boost::system::system_category());
+                if (_scan_error_callback) _scan_error_callback(p.parent_path(), p, ec.default_error_condition());
+                fclose(file);
+                return false;
+            }
+            fclose(file);
+            key = digest_key(file_size, digest, length);
+            _record_read(p, read_method::buffered, length);
+
+            return true;
+        }
+
+        auto& hasher = _thread_hasher();
+        if (!_feed_range(p, offset, length, hasher)) return false;
+        hasher.finish(digest);
+        key = digest_key(file_size, digest, HashT::digest_size);
+
+        return true;
+    }
+
+    template <typename SorterT, typename HashT>
+    bool duplicate_files_scanner<SorterT, HashT>::_feed_range(const boost::filesystem::path& p, uintmax_t offset, uintmax_t length, HashT& hasher)
+    {
+        boost::system::error_code ec;
+        boost::filesystem::path directory = p;
+        directory.remove_filename();
+
+#if defined(OASIS_HAVE_MMAP)
+        if ((_read_method == read_method::memory_mapped) && (length >= _mmap_threshold))
+        {
+            // The range is mapped a slice at a time, so a pause never waits long to unmap it.
+            static constexpr uintmax_t slice = 67108864;
+            for (uintmax_t position = 0; position < length; position += slice)
+            {
+                if ((position != 0) && !_checkpoint()) return false;
+                read_request request;
+                request.path = p;
+                request.offset = offset + position;
+                request.length = std::min(slice, length - position);
+                request.consume = [&hasher](const uint8_t *data, std::size_t size) { hasher.update(data, size); };
+                read_mapped(request);
+                if (request.error)
+                {
+                    if (_scan_error_callback) _scan_error_callback(directory, p, request.error.default_error_condition());
+                    return false;
+                }
+            }
+            _record_read(p, read_method::memory_mapped, length);
+
+            return true;
+        }
+#endif
+
+        FILE *file = nullptr;
+        buffer_pool::lease buffer;
+        uintmax_t remaining = length;
+        while (remaining > 0)
+        {
+            // Opened again, at the position reached, after every pause.
+            if (file == nullptr)
+            {
+                file = _open_at(p, offset + length - remaining);
+                if (file == nullptr) return false;
+
+                // Borrow a buffer, waiting for one to be returned if the pool is at its limit.
+                try
+                {
+                    buffer = _buffers->acquire();
+                }
+                catch (const std::bad_alloc&)
+                {
+                    ec = boost::system::error_code(ENOMEM, boost::system::system_category());
+                    if (_scan_error_callback) _scan_error_callback(directory, p, ec.default_error_condition());
+                    fclose(file);
+                    return false;
+                }
+            }
+            auto buffer_size = buffer.size();
+
+            auto bytes_read = fread(buffer.data(), 1, (remaining < buffer_size) ? remaining : buffer_size, file);
+            if ((bytes_read == 0) || ferror(file))
+            {
+                ec = boost::system::error_code(ferror(file) ? errno : EIO, boost::system::system_category());
+                if (_scan_error_callback) _scan_error_callback(directory, p, ec.default_error_condition());
+                fclose(file);
+                return false;
+            }
+            hasher.update(buffer.data(), bytes_read);
+            remaining -= bytes_read;
+
+            if ((remaining > 0) && _control->interrupted())
+            {
+                fclose(file);
+                file = nullptr;
+                buffer.reset();
+                if (!_checkpoint()) return false;
+            }
+        }
+        fclose(file);
+        _record_read(p, read_method::buffered, length);
+
+        return true;
+    }
+
+    template <typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_record_read(const boost::filesystem::path& p, read_method method, uintmax_t length)
+    {
+        _counter_lock.lock();
+        _bytes_read += length;
+        switch (method)
+        {
+            case read_method::io_uring:
+                _files_read_io_uring++;
+                break;
+            case read_method::memory_mapped:
+                _files_read_mapped++;
+                break;
+            default:
+                _files_read_buffered++;
+                break;
+        }
+        _counter_lock.unlock();
+
+        if (_file_read_callback) _file_read_callback(p, method, length);
+    }
+
+    template <typename SorterT, typename HashT>
+    bool duplicate_files_scanner<SorterT, HashT>::_use_io_uring() const
+    {
+#if defined(OASIS_HAVE_IO_URING)
+        return (_read_method == read_method::io_uring) && uring_file_reader::available();
+#else
+        return false;
+#endif
+    }
+
+    template <typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_digest_batch(const std::shared_ptr<_group>& g, std::size_t first, std::size_t count, uintmax_t offset, uintmax_t length)
+    {
+        if (!_checkpoint())
+        {
+            if (g->pending.fetch_sub(count) == count) _complete(g);
+            return;
+        }
+
+        bool done = false;
+#if defined(OASIS_HAVE_IO_URING)
+        // The ring and its buffers live for as long as the worker thread, which ends with the scan.
+        static thread_local std::unique_ptr<uring_file_reader> reader;
+        try
+        {
+            if (!reader || (reader->depth() < _queue_depth)) reader = std::make_unique<uring_file_reader>(_queue_depth);
+        }
+        catch (const std::system_error&)
+        {
+            reader.reset();
+        }
+
+        if (reader)
+        {
+            // Short ranges are used as their own digest, exactly as the blocking path does.
+            struct accumulator
+            {
+                HashT *hasher = nullptr;
+                uint8_t raw[HashT::digest_size];
+                std::size_t filled = 0;
+            };
+            bool raw = (length <= HashT::digest_size);
+            std::unique_ptr<accumulator[]> acc(new accumulator[count]);
+            std::vector<read_request> requests(count);
+            std::vector<_stamp> stamps(count);
+            for (std::size_t i = 0; i < count; i++)
+            {
+                if (g->stage == _stage::full) stamps[i] = _take_stamp(g->members[first + i]);
+                auto& a = acc[i];
+                a.hasher = &_thread_hasher(i);
+                requests[i].path = g->members[first + i];
+                requests[i].offset = offset;
+                requests[i].length = length;
+                requests[i].consume = [&a, raw](const uint8_t *data, std::size_t size)
+                {
+                    if (raw)
+                    {
+                        std::memcpy(a.raw + a.filled, data, size);
+                        a.filled += size;
+                    }
+                    else
+                    {
+                        a.hasher->update(data, size);
+                    }
+                };
+            }
+
+            reader->read(requests, *_buffers);
+
+            for (std::size_t i = 0; i < count; i++)
+            {
+                auto& p = g->members[first + i];
+                if (requests[i].error)
+                {
+                    if (_scan_error_callback) _scan_error_callback(p.parent_path(), p, requests[i].error.default_error_condition());
+                    continue;
+                }
+                if (raw)
+                {
+                    g->keys[first + i] = digest_key(g->file_size, acc[i].raw, static_cast<std::size_t>(length));
+                }
+                else
+                {
+                    uint8_t digest[HashT::digest_size];
+                    acc[i].hasher->finish(digest);
+                    g->keys[first + i] = digest_key(g->file_size, digest, HashT::digest_size);
+                }
+                g->valid[first + i] = 1;
+                _remember(stamps[i], g->keys[first + i]);
+                _record_read(p, read_method::io_uring, length);
+            }
+            done = true;
+        }
+#endif
+
+        for (std::size_t i = first; i < first + count; i++)
+        {
+            if (!done)
+            {
+                _stamp stamp;
+                if (g->stage == _stage::full) stamp = _take_stamp(g->members[i]);
+                g->valid[i] = _digest_range(g->members[i], g->file_size, offset, length, g->keys[i]);
+                if (g->valid[i]) _remember(stamp, g->keys[i]);
+            }
+            _report_progress(g->members[i]);
+        }
+        if (g->pending.fetch_sub(count) == count) _complete(g);
+    }
+
+    template <typename SorterT, typename HashT>
+    HashT& duplicate_files_scanner<SorterT, HashT>::_thread_hasher(std::size_t index)
+    {
+        // Every thread keeps its hashing contexts until it exits, they are reset rather than re-created for each file.
+        static thread_local std::vector<std::unique_ptr<HashT>> hashers;
+        while (hashers.size() <= index) hashers.push_back(std::make_unique<HashT>());
+        hashers[index]->reset();
+
+        return *hashers[index];
+    }
+
+    template <typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_compare_group(uintmax_t file_size, std::vector<boost::filesystem::path> members, uintmax_t offset)
+    {
+        if (members.size() <= _open_file_budget)
+        {
+            _lockstep(file_size, std::move(members), offset);
+            return;
+        }
+
+        // Too many to open at once, split the group on the contents of the next block, one file at a time. Every part
+        // either shrinks or moves on to the next block, so this always ends.
+        uintmax_t length = std::min<uintmax_t>(_block_size, file_size - offset);
+        std::map<std::string, std::vector<boost::filesystem::path>> parts;
+        std::string block(static_cast<std::size_t>(length), '\0');
+        for (auto& p : members)
+        {
+            if (!_checkpoint()) return;
+            FILE *file = _open_at(p, offset);
+            if (file == nullptr) continue;
+            auto bytes_read = fread(block.data(), 1, block.size(), file);
+            fclose(file);
+            if (bytes_read != block.size())
+            {
+                auto ec = boost::system::error_code(EIO, boost::system::system_category());
+                if (_scan_error_callback) _scan_error_callback(p.parent_path(), p, ec.default_error_condition());
+                continue;
+            }
+            _record_read(p, read_method::buffered, length);
+            parts[block].push_back(std::move(p));
+        }
+
+        for (auto& part : parts)
+        {
+            if ((part.second.size() == 1) || (offset + length == file_size))
+            {
+                _add_class(file_size, part.second);
+                continue;
+            }
+            _compare_group(file_size, std::move(part.second), offset + length);
+        }
+    }
+
+    template <typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_lockstep(uintmax_t file_size, std::vector<boost::filesystem::path> members, uintmax_t offset)
+    {
+        // A member that cannot be compared for want of a buffer is reported as _feed_range() reports a file.
+        auto out_of_memory = [this](const boost::filesystem::path& p)
+        {
+            auto ec = boost::system::error_code(ENOMEM, boost::system::system_category());
+            if (_scan_error_callback) _scan_error_callback(p.parent_path(), p, ec.default_error_condition());
+        };
+
+        // One buffer is shared between the members, each reads its chunk into its own slice.
+        buffer_pool::lease buffer;
+        try
+        {
+            buffer = _buffers->acquire();
+        }
+        catch (const std::bad_alloc&)
+        {
+            for (const auto& p : members)
+            {
+                out_of_memory(p);
+            }
+            return;
+        }
+        std::size_t chunk = buffer.size() / members.size();
+        chunk -= (chunk > 4096) ? (chunk % 4096) : 0;
+        if (chunk == 0) chunk = 1;
+
+        std::vector<FILE *> files(members.size(), nullptr);
+        std::vector<std::vector<std::size_t>> active(1);
+        for (std::size_t i = 0; i < members.size(); i++)
+        {
+            files[i] = _open_at(members[i], offset);
+            if (files[i] != nullptr) active.front().push_back(i);
+        }
+
+        auto finish = [&](const std::vector<std::size_t>& cls)
+        {
+            std::vector<boost::filesystem::path> paths;
+            for (auto i : cls)
+            {
+                fclose(files[i]);
+                files[i] = nullptr;
+                paths.push_back(members[i]);
+            }
+            _add_class(file_size, paths);
+        };
+
+        uintmax_t position = offset;
+        while ((position < file_size) && !active.empty())
+        {
+            if (_control->interrupted())
+            {
+                // The classes still being compared are dropped on a cancellation, and opened again after a pause.
+                for (auto& file : files)
+                {
+                    if (file != nullptr) fclose(file);
+                    file = nullptr;
+                }
+                buffer.reset();
+                if (!_checkpoint()) return;
+                try
+                {
+                    buffer = _buffers->acquire();
+                }
+                catch (const std::bad_alloc&)
+                {
+                    for (const auto& cls : active)
+                    {
+                        for (auto i : cls)
+                        {
+                            out_of_memory(members[i]);
+                        }
+                    }
+                    return;
+                }
+                std::vector<std::vector<std::size_t>> reopened;
+                for (const auto& cls : active)
+                {
+                    reopened.emplace_back();
+                    for (auto i : cls)
+                    {
+                        files[i] = _open_at(members[i], position);
+                        if (files[i] != nullptr) reopened.back().push_back(i);
+                    }
+                    if (reopened.back().empty()) reopened.pop_back();
+                }
+                active = std::move(reopened);
+                continue;
+            }
+
+            auto length = static_cast<std::size_t>(std::min<uintmax_t>(chunk, file_size - position));
+            std::vector<std::vector<std::size_t>> next;
+            for (const auto& cls : active)
+            {
+                if (cls.size() == 1)
+                {
+                    finish(cls);
+                    continue;
+                }
+
+                // Read the next chunk of every member and split the class wherever the bytes differ.
+                std::vector<std::vector<std::size_t>> split;
+                for (auto i : cls)
+                {
+                    uint8_t *data = buffer.data() + (i * chunk);
+                    if (fread(data, 1, length, files[i]) != length)
+                    {
+                        auto ec = boost::system::error_code(ferror(files[i]) ? errno : EIO, boost::system::system_category());
+                        if (_scan_error_callback) _scan_error_callback(members[i].parent_path(), members[i], ec.default_error_condition());
+                        fclose(files[i]);
+                        files[i] = nullptr;
+                        continue;
+                    }
+                    _counter_lock.lock();
+                    _bytes_read += length;
+                    _counter_lock.unlock();
+
+                    auto match = std::find_if(split.begin(), split.end(), [&](const std::vector<std::size_t>& s) { return std::memcmp(buffer.data() + (s.front() * chunk), data, length) == 0; });
+                    if (match == split.end())
+                    {
+                        split.emplace_back(1, i);
+                    }
+                    else
+                    {
+                        match->push_back(i);
+                    }
+                }
+
+                for (auto& s : split)
+                {
+                    next.push_back(std::move(s));
+                }
+            }
+            active = std::move(next);
+            position += length;
+        }
+
+        for (const auto& cls : active)
+        {
+            finish(cls);
+        }
+    }
+
+    template <typename SorterT, typename HashT>
+    FILE *duplicate_files_scanner<SorterT, HashT>::_open_at(const boost::filesystem::path& p, uintmax_t offset)
+    {
+        boost::system::error_code ec;
+        FILE *file = nullptr;
+        for (;;)
+        {
+#if defined (_MSC_VER)
+            file = _wfopen(p.wstring().c_str(), L"rbS");
+#else
+            file = fopen64(p.string().c_str(), "rb");
+#endif
+            if (file != nullptr) break;
+            if ((errno == ENFILE) || (errno == EMFILE) || (errno == ENOSR) || (errno == EAGAIN))
+            {
+                boost::this_thread::sleep_for(boost::chrono::seconds(5));
+                continue;
+            }
+            ec = boost::system::error_code(errno, boost::system::system_category());
+            if (_scan_error_callback) _scan_error_callback(p.parent_path(), p, ec.default_error_condition());
+            return nullptr;
+        }
+
+#if defined (_MSC_VER)
+        if ((offset != 0) && (_fseeki64(file, offset, SEEK_SET) != 0))
+#else
+        if ((offset != 0) && (fseeko64(file, offset, SEEK_SET) != 0))
+#endif
+        {
+            ec = boost::system::error_code(errno, boost::system::system_category());
+            if (_scan_error_callback) _scan_error_callback(p.parent_path(), p, ec.default_error_condition());
+            fclose(file);
+            return nullptr;
+        }
+
+        return file;
+    }
+
+    template <typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_add_class(uintmax_t file_size, const std::vector<boost::filesystem::path>& members)
+    {
+        // Files that were compared byte for byte have no digest. The set is named by the size and a digest of the path of
+        // its least member instead, which no other set can share and which does not depend on the order the classes are
+        // settled in, so every scan of the same tree names and orders the sets alike.
+        if (members.empty()) return;
+        _counter_lock.lock();
+        if (members.size() == 1) _eliminated_by_full++;
+        _counter_lock.unlock();
+
+        for (const auto& p : members)
+        {
+            _report_progress(p);
+        }
+        if ((members.size() == 1) && _remove_single) return;
+
+        static constexpr char tag[] = "lockstep:";
+        const auto& first = std::min_element(members.begin(), members.end())->native();
+        uint8_t digest[HashT::digest_size];
+        auto& hasher = _thread_hasher();
+        hasher.update(tag, sizeof(tag) - 1);
+        hasher.update(first.data(), first.size() * sizeof(boost::filesystem::path::value_type));
+        hasher.finish(digest);
+        digest_key key(file_size, digest, HashT::digest_size);
+        for (const auto& p : members)
+        {
+            _add_to_set(key, p);
+        }
+    }
+
+    template <typename SorterT, typename HashT>
+    digest_key duplicate_files_scanner<SorterT, HashT>::_combine_keys(const digest_key& first, const digest_key& second)
+    {
+        uint8_t digest[HashT::digest_size];
+        auto& hasher = _thread_hasher();
+        hasher.update(first.data(), first.length());
+        hasher.update(second.data(), second.length());
+        hasher.finish(digest);
+
+        return digest_key(first.file_size(), digest, HashT::digest_size);
+    }
+
+    template <typename SorterT, typename HashT>
+    void duplicate_files_scanner<SorterT, HashT>::_add_to_set(const digest_key& key, const boost::filesystem::path& p)
+    {
+        // Query set for discovered hash.
+        // The path is stored before the set is looked up, so a path that cannot be stored leaves no empty set behind.
+        std::vector<boost::filesystem::path> joined;
+        boost::unique_lock<boost::mutex> list(_list_lock);
+        bool created;
+        auto id = _paths.add(p, created);
+        auto set = _sets.find_or_add(key);
+
+        // A path that is new to the store cannot be in any set yet, only one that was added before is looked for.
+        bool inserted = _sets.insert(set, id, !created);
+        auto size = _sets[set].size;
+        if (inserted && (size == 2)) _sets_found++;
+        if (inserted && _set_callback)
+        {
+            if (size == 2)
+            {
+                joined.push_back(_paths.path(_sets.members(set).front()));
+                joined.push_back(p);
+            }
+            else if (size > 2)
+            {
+                joined.push_back(p);
+            }
+        }
+
+        // The callback lock is taken before the list is released, so the calls for a set keep their order.
+        boost::unique_lock<boost::mutex> guard(_set_callback_lock, boost::defer_lock);
+        if (!joined.empty()) guard.lock();
+        list.unlock();
+
+        if (joined.empty()) return;
+        _set_callback((joined.size() == 2) ? set_event::found : set_event::grown, key, joined);
     }
 }
 
@@ -0,0 +1,477 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <system_error>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/thread.hpp>
+#include "foundation.hpp"
+#include "buffer_pool.hpp"
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define OASIS_HAVE_MMAP
+#endif
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#define OASIS_HAVE_IO_URING
+#endif
+
+#ifndef _FILE_READER_HPP_
+#define _FILE_READER_HPP_
+
+namespace oasis::filesystem
+{
+    /**********************************************************************************************//**
+     * @enum	read_method
+     *
+     * @brief	The ways in which the contents of a file can be read for hashing.
+     **************************************************************************************************/
+
+    enum class read_method
+    {
+        buffered,   ///< Blocking reads through the C library, one file in flight per thread.
+        io_uring,   ///< Asynchronous reads through io_uring, many files in flight per thread.
+        memory_mapped,  ///< Large files are hashed straight from a read-only mapping, without copying.
+    };
+
+    /**********************************************************************************************//**
+     * @struct	read_request
+     *
+     * @brief	A range of a file to be read, together with the function that consumes the data.
+     **************************************************************************************************/
+
+    struct read_request
+    {
+        boost::filesystem::path path;
+        uintmax_t offset = 0;
+        uintmax_t length = 0;
+        std::function<void(const uint8_t *, std::size_t)> consume;
+        boost::system::error_code error;
+    };
+
+#if defined(OASIS_HAVE_MMAP)
+
+    /**********************************************************************************************//**
+     * @fn	inline void read_mapped(read_request& request, std::size_t window = 268435456)
+     *
+     * @brief	Reads a request by mapping the file into memory and passing the mapped pages directly
+     * 			to the consumer, saving the copy into a user space buffer.
+     *
+     * 			The range is mapped one window at a time with \c MADV_SEQUENTIAL, so the kernel reads
+     * 			ahead aggressively and drops the pages behind the consumer, and the address space used
+     * 			stays bounded however large the file is. The size of the file is checked before each
+     * 			window is mapped, but a file that is truncated while the consumer is reading a window
+     * 			will still raise \c SIGBUS, which is left to the process to handle, so this method
+     * 			should only be used on files that are not being modified.
+     *
+     * 			The outcome is left in the \c error member of \p request.
+     *
+     * @param [in,out]	request	The range to read.
+     * @param 		  	window 	(Optional) The largest amount of the file mapped at once, in bytes.
+     **************************************************************************************************/
+
+    inline void read_mapped(read_request& request, std::size_t window = 268435456)
+    {
+        request.error.clear();
+        if (request.length == 0) return;
+
+        int fd;
+        for (;;)
+        {
+            fd = open(request.path.string().c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd >= 0) break;
+            if ((errno == ENFILE) || (errno == EMFILE) || (errno == ENOSR) || (errno == EAGAIN))
+            {
+                boost::this_thread::sleep_for(boost::chrono::seconds(5));
+                continue;
+            }
+            request.error = boost::system::error_code(errno, boost::system::generic_category());
+            return;
+        }
+
+        auto page = static_cast<uintmax_t>(sysconf(_SC_PAGESIZE));
+        uintmax_t position = request.offset;
+        uintmax_t remaining = request.length;
+        while (remaining > 0)
+        {
+            struct stat st{};
+            if (fstat(fd, &st) != 0)
+            {
+                request.error = boost::system::error_code(errno, boost::system::generic_category());
+                break;
+            }
+            if (static_cast<uintmax_t>(st.st_size) < position + remaining)
+            {
+                // The file is shorter than it was when it was examined.
+                request.error = boost::system::error_code(EIO, boost::system::generic_category());
+                break;
+            }
+
+            // Mappings must start on a page boundary.
+            uintmax_t start = position - (position % page);
+            uintmax_t skip = position - start;
+            std::size_t size = (remaining < window) ? static_cast<std::size_t>(remaining) : window;
+            void *map = mmap(nullptr, skip + size, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(start));
+            if (map == MAP_FAILED)
+            {
+                request.error = boost::system::error_code(errno, boost::system::generic_category());
+                break;
+            }
+            madvise(map, skip + size, MADV_SEQUENTIAL);
+            if (request.consume) request.consume(static_cast<const uint8_t *>(map) + skip, size);
+            munmap(map, skip + size);
+
+            position += size;
+            remaining -= size;
+        }
+
+        close(fd);
+    }
+
+#endif
+
+#if defined(OASIS_HAVE_IO_URING)
+
+    /**********************************************************************************************//**
+     * @class	uring_file_reader file_reader.hpp
+     *
+     * @brief	Reads many files concurrently through a private io_uring instance.
+     *
+     * 			Up to \c depth files are open at once, each with one read outstanding into a buffer
+     * 			borrowed from a buffer_pool for as long as the file is open. As each read completes its data is passed to the consumer of the request and
+     * 			the next read for that file is queued immediately, so the device always has a full
+     * 			queue of work while the calling thread hashes. The kernel interface is used directly,
+     * 			no additional library is required.
+     *
+     * 			An instance must only be used by one thread at a time.
+     **************************************************************************************************/
+
+    class uring_file_reader
+    {
+    private:
+        struct _slot
+        {
+            std::size_t request;
+            int fd;
+            uintmax_t position;
+            uintmax_t remaining;
+            struct iovec iov;
+            buffer_pool::lease buffer;
+        };
+
+        int _ring_fd;
+        unsigned int _depth;
+        void *_sq_ptr;
+        std::size_t _sq_size;
+        void *_cq_ptr;
+        std::size_t _cq_size;
+        struct io_uring_sqe *_sqes;
+        std::size_t _sqes_size;
+        unsigned int *_sq_tail;
+        unsigned int *_sq_mask;
+        unsigned int *_sq_array;
+        unsigned int *_cq_head;
+        unsigned int *_cq_tail;
+        unsigned int *_cq_mask;
+        struct io_uring_cqe *_cqes;
+        std::vector<_slot> _slots;
+
+        void _release() noexcept
+        {
+            if ((_sqes != nullptr) && (_sqes != MAP_FAILED)) munmap(_sqes, _sqes_size);
+            if ((_cq_ptr != nullptr) && (_cq_ptr != MAP_FAILED) && (_cq_ptr != _sq_ptr)) munmap(_cq_ptr, _cq_size);
+            if ((_sq_ptr != nullptr) && (_sq_ptr != MAP_FAILED)) munmap(_sq_ptr, _sq_size);
+            if (_ring_fd >= 0) close(_ring_fd);
+            _sqes = nullptr;
+            _cq_ptr = nullptr;
+            _sq_ptr = nullptr;
+            _ring_fd = -1;
+        }
+
+        void _queue_read(std::size_t slot)
+        {
+            auto& s = _slots[slot];
+            unsigned int tail = *_sq_tail;
+            unsigned int index = tail & *_sq_mask;
+            auto *sqe = &_sqes[index];
+            std::memset(sqe, 0, sizeof(*sqe));
+            s.iov.iov_len = (s.remaining < s.buffer.size()) ? static_cast<std::size_t>(s.remaining) : s.buffer.size();
+            sqe->opcode = IORING_OP_READV;
+            sqe->fd = s.fd;
+            sqe->addr = reinterpret_cast<uint64_t>(&s.iov);
+            sqe->len = 1;
+            sqe->off = s.position;
+            sqe->user_data = slot;
+            _sq_array[index] = index;
+            std::atomic_ref<unsigned int>(*_sq_tail).store(tail + 1, std::memory_order_release);
+        }
+
+        int _enter(unsigned int to_submit, unsigned int min_complete) noexcept
+        {
+            for (;;)
+            {
+                auto ret = syscall(__NR_io_uring_enter, _ring_fd, to_submit, min_complete, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (ret >= 0) return 0;
+                if (errno == EINTR) continue;
+                return errno;
+            }
+        }
+
+        static int _open(const boost::filesystem::path& p) noexcept
+        {
+            for (;;)
+            {
+                int fd = open(p.string().c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd >= 0)
+                {
+                    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+                    return fd;
+                }
+                if ((errno == ENFILE) || (errno == EMFILE) || (errno == ENOSR) || (errno == EAGAIN))
+                {
+                    boost::this_thread::sleep_for(boost::chrono::seconds(5));
+                    continue;
+                }
+                return -errno;
+            }
+        }
+
+    public:
+
+        /**********************************************************************************************//**
+         * @fn	uring_file_reader::uring_file_reader(unsigned int depth = 32)
+         *
+         * @brief	Creates a new io_uring instance.
+         *
+         * @exception	std::system_error	Thrown if the kernel does not support io_uring, or its use is
+         * 									not permitted.
+         *
+         * @param 	depth	(Optional) The maximum number of files with a read in flight.
+         **************************************************************************************************/
+
+        explicit uring_file_reader(unsigned int depth = 32)
+        {
+            if (depth == 0) depth = 1;
+            _ring_fd = -1;
+            _sq_ptr = nullptr;
+            _cq_ptr = nullptr;
+            _sqes = nullptr;
+
+            struct io_uring_params params{};
+            _ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+            if (_ring_fd < 0) throw std::system_error(errno, std::generic_category());
+            _depth = params.sq_entries;
+
+            _sq_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned int));
+            _cq_size = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+            bool single = ((params.features & IORING_FEAT_SINGLE_MMAP) != 0);
+            if (single) _sq_size = _cq_size = std::max(_sq_size, _cq_size);
+
+            _sq_ptr = mmap(nullptr, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+            if (_sq_ptr == MAP_FAILED)
+            {
+                int error = errno;
+                _release();
+                throw std::system_error(error, std::generic_category());
+            }
+            _cq_ptr = single ? _sq_ptr : mmap(nullptr, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_CQ_RING);
+            _sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+            _sqes = static_cast<struct io_uring_sqe *>(mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES));
+            if ((_cq_ptr == MAP_FAILED) || (_sqes == MAP_FAILED))
+            {
+                int error = errno;
+                _release();
+                throw std::system_error(error, std::generic_category());
+            }
+
+            auto *sq = static_cast<uint8_t *>(_sq_ptr);
+            auto *cq = static_cast<uint8_t *>(_cq_ptr);
+            _sq_tail = reinterpret_cast<unsigned int *>(sq + params.sq_off.tail);
+            _sq_mask = reinterpret_cast<unsigned int *>(sq + params.sq_off.ring_mask);
+            _sq_array = reinterpret_cast<unsigned int *>(sq + params.sq_off.array);
+            _cq_head = reinterpret_cast<unsigned int *>(cq + params.cq_off.head);
+            _cq_tail = reinterpret_cast<unsigned int *>(cq + params.cq_off.tail);
+            _cq_mask = reinterpret_cast<unsigned int *>(cq + params.cq_off.ring_mask);
+            _cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+            _slots.resize(_depth);
+            for (auto& slot : _slots)
+            {
+                slot.fd = -1;
+            }
+        }
+
+        uring_file_reader(const uring_file_reader&) = delete;
+
+        uring_file_reader& operator=(const uring_file_reader&) = delete;
+
+        ~uring_file_reader()
+        {
+            _release();
+        }
+
+        /**********************************************************************************************//**
+         * @fn	static bool uring_file_reader::available() noexcept
+         *
+         * @brief	Determines whether io_uring can be used by this process, the answer is cached after
+         * 			the first call.
+         **************************************************************************************************/
+
+        static bool available() noexcept
+        {
+            static const bool result = []()
+            {
+                struct io_uring_params params{};
+                int fd = static_cast<int>(syscall(__NR_io_uring_setup, 1, &params));
+                if (fd < 0) return false;
+                close(fd);
+                return true;
+            }();
+
+            return result;
+        }
+
+        [[nodiscard]] unsigned int depth() const noexcept
+        {
+            return _depth;
+        }
+
+        /**********************************************************************************************//**
+         * @fn	void uring_file_reader::read(std::vector<read_request>& requests, buffer_pool& buffers)
+         *
+         * @brief	Reads every request, passing the data of each one to its consumer in file order.
+         *
+         * 			The outcome of each request is left in its \c error member, a file that could not be
+         * 			opened or read, or that ended before the requested range was complete, has a non-zero
+         * 			error and its consumer may have seen only part of the data.
+         *
+         * 			A new file is only started while a buffer can be taken from \p buffers without
+         * 			waiting, so when the pool is at its limit fewer files are kept in flight. The reader
+         * 			only blocks for a buffer when it holds none.
+         *
+         * @param [in,out]	requests	The ranges to read.
+         * @param [in,out]	buffers 	The pool the read buffers are borrowed from, the size of its
+         * 								buffers is the size of each read.
+         **************************************************************************************************/
+
+        void read(std::vector<read_request>& requests, buffer_pool& buffers)
+        {
+            std::size_t next = 0;
+            unsigned int in_flight = 0;
+            unsigned int to_submit = 0;
+            std::vector<std::size_t> free_slots;
+            for (std::size_t i = _depth; i > 0; i--) free_slots.push_back(i - 1);
+
+            for (;;)
+            {
+                // Start as many new files as there are free slots.
+                while (!free_slots.empty() && (next < requests.size()))
+                {
+                    auto& r = requests[next];
+                    r.error.clear();
+                    if (r.length == 0)
+                    {
+                        next++;
+                        continue;
+                    }
+                    auto buffer = (in_flight == 0) ? buffers.acquire() : buffers.try_acquire();
+                    if (!buffer) break;
+                    int fd = _open(r.path);
+                    if (fd < 0)
+                    {
+                        r.error = boost::system::error_code(-fd, boost::system::generic_category());
+                        next++;
+                        continue;
+                    }
+                    auto slot = free_slots.back();
+                    free_slots.pop_back();
+                    _slots[slot].buffer = std::move(buffer);
+                    _slots[slot].iov.iov_base = _slots[slot].buffer.data();
+                    _slots[slot].request = next++;
+                    _slots[slot].fd = fd;
+                    _slots[slot].position = r.offset;
+                    _slots[slot].remaining = r.length;
+                    _queue_read(slot);
+                    to_submit++;
+                    in_flight++;
+                }
+
+                if (in_flight == 0) break;
+
+                int error = _enter(to_submit, 1);
+                if (error != 0)
+                {
+                    // The ring itself has failed, fail everything that is outstanding.
+                    for (auto& s : _slots)
+                    {
+                        if (s.fd < 0) continue;
+                        requests[s.request].error = boost::system::error_code(error, boost::system::generic_category());
+                        close(s.fd);
+                        s.fd = -1;
+                        s.buffer.reset();
+                    }
+                    for (; next < requests.size(); next++)
+                    {
+                        requests[next].error = boost::system::error_code(error, boost::system::generic_category());
+                    }
+                    return;
+                }
+                to_submit = 0;
+
+                unsigned int head = *_cq_head;
+                unsigned int tail = std::atomic_ref<unsigned int>(*_cq_tail).load(std::memory_order_acquire);
+                while (head != tail)
+                {
+                    auto& cqe = _cqes[head & *_cq_mask];
+                    auto slot = static_cast<std::size_t>(cqe.user_data);
+                    auto res = cqe.res;
+                    head++;
+
+                    auto& s = _slots[slot];
+                    auto& r = requests[s.request];
+                    if (res < 0)
+                    {
+                        r.error = boost::system::error_code(-res, boost::system::generic_category());
+                    }
+                    else if (res == 0)
+                    {
+                        // The file is shorter than it was when it was examined.
+                        r.error = boost::system::error_code(EIO, boost::system::generic_category());
+                    }
+                    else
+                    {
+                        if (r.consume) r.consume(static_cast<const uint8_t *>(s.iov.iov_base), static_cast<std::size_t>(res));
+                        s.position += static_cast<uintmax_t>(res);
+                        s.remaining -= static_cast<uintmax_t>(res);
+                        if (s.remaining != 0)
+                        {
+                            _queue_read(slot);
+                            to_submit++;
+                            continue;
+                        }
+                    }
+
+                    close(s.fd);
+                    s.fd = -1;
+                    s.buffer.reset();
+                    free_slots.push_back(slot);
+                    in_flight--;
+                }
+                std::atomic_ref<unsigned int>(*_cq_head).store(head, std::memory_order_release);
+            }
+        }
+    };
+
+#endif
+}
+
+#endif //_FILE_READER_HPP_
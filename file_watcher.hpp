@@ -0,0 +1,389 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include "foundation.hpp"
+#include "directory_enumerator.hpp"
+#if defined(__linux__) && __has_include(<sys/inotify.h>)
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#if __has_include(<sys/fanotify.h>)
+#include <sys/fanotify.h>
+#endif
+#define OASIS_HAVE_FILE_WATCHER
+#endif
+
+#ifndef _FILE_WATCHER_HPP_
+#define _FILE_WATCHER_HPP_
+
+#if defined(OASIS_HAVE_FILE_WATCHER)
+
+namespace oasis::filesystem
+{
+    /**********************************************************************************************//**
+     * @struct	file_change
+     *
+     * @brief	A path that may have changed. Nothing more is reported, it is up to the receiver to look
+     * 			at the path again: a file may have been created, written, renamed or removed, and every
+     * 			entry below a directory may have appeared or gone.
+     **************************************************************************************************/
+
+    struct file_change
+    {
+        boost::filesystem::path path;
+        bool directory = false;
+    };
+
+    /**********************************************************************************************//**
+     * @class	file_watcher file_watcher.hpp
+     *
+     * @brief	Reports changes to the files below a directory.
+     *
+     * 			fanotify is used where the process is permitted to mark a whole file system and the
+     * 			kernel can report the names of the entries that changed (Linux 5.9 and later), it needs
+     * 			no per directory set up however large the tree is. Everywhere else one inotify watch is
+     * 			added for each directory, and for each directory created or moved into the tree later.
+     *
+     * 			If the kernel drops events because they were not read quickly enough, the root
+     * 			directory is reported as changed.
+     **************************************************************************************************/
+
+    class file_watcher
+    {
+    private:
+        boost::filesystem::path _root;
+        bool _recurse;
+        bool _skip_hidden;
+        int _fd;
+        int _wake;
+        int _mount;
+        bool _fanotify;
+        std::unordered_map<int, boost::filesystem::path> _watches;
+        std::map<boost::filesystem::path, int> _directories;
+        std::unordered_map<std::string, boost::filesystem::path> _handles;
+        std::map<boost::filesystem::path, std::string> _handle_paths;
+        std::function<void(const boost::filesystem::path&, const std::error_condition&)> _error_callback;
+
+        void _report(const boost::filesystem::path& p, int error)
+        {
+            if (_error_callback) _error_callback(p, std::error_code(error, std::generic_category()).default_error_condition());
+        }
+
+        bool _start_fanotify()
+        {
+#if defined(FAN_REPORT_DFID_NAME) && defined(FAN_MARK_FILESYSTEM)
+            int fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) return false;
+            uint64_t mask = FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_MODIFY | FAN_CLOSE_WRITE | FAN_ONDIR;
+            int mount = open(_root.string().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if ((mount < 0) || (fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, _root.string().c_str()) != 0))
+            {
+                if (mount >= 0) close(mount);
+                close(fd);
+                return false;
+            }
+            _fd = fd;
+            _mount = mount;
+            _fanotify = true;
+
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        // Watches a directory and, when recursing, every directory below it that is not a link.
+        void _add_tree(const boost::filesystem::path& dir)
+        {
+            static constexpr uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_EXCL_UNLINK | IN_ONLYDIR;
+
+            std::vector<boost::filesystem::path> pending{ dir };
+            while (!pending.empty())
+            {
+                auto d = std::move(pending.back());
+                pending.pop_back();
+                int wd = inotify_add_watch(_fd, d.string().c_str(), mask);
+                if (wd < 0)
+                {
+                    // A directory that has already gone will be reported by its parent.
+                    if (errno != ENOENT) _report(d, errno);
+                    continue;
+                }
+                _watches[wd] = d;
+                _directories[d] = wd;
+                if (!_recurse) continue;
+
+                boost::system::error_code ec;
+                try
+                {
+                    directory_enumerator de(d);
+                    while (de.move_next(ec))
+                    {
+                        // Only directories are watched, the type recorded in the directory spares a look at every file.
+                        auto type = de.type();
+                        if ((type != entry_type::directory) && (type != entry_type::unknown)) continue;
+                        const auto& entry = de.current();
+                        if (_skip_hidden && is_hidden(entry, ec)) continue;
+                        if ((type == entry_type::directory) || boost::filesystem::is_directory(boost::filesystem::symlink_status(entry, ec))) pending.push_back(entry);
+                    }
+                }
+                catch (const std::exception&)
+                {
+                    // The directory went away while it was being read, its parent reports that.
+                }
+            }
+        }
+
+        // Stops watching a directory that has left the tree, and every directory below it.
+        void _remove_tree(const boost::filesystem::path& dir)
+        {
+            for (auto it = _directories.lower_bound(dir); (it != _directories.end()) && is_within(it->first, dir);)
+            {
+                inotify_rm_watch(_fd, it->second);
+                _watches.erase(it->second);
+                it = _directories.erase(it);
+            }
+        }
+
+        void _read_inotify(std::vector<file_change>& changes)
+        {
+            alignas(struct inotify_event) char buffer[65536];
+            for (;;)
+            {
+                auto length = read(_fd, buffer, sizeof(buffer));
+                if (length <= 0)
+                {
+                    if ((length < 0) && (errno != EAGAIN) && (errno != EINTR)) throw std::system_error(errno, std::generic_category());
+                    return;
+                }
+
+                for (char *ptr = buffer; ptr < buffer + length;)
+                {
+                    auto event = reinterpret_cast<const struct inotify_event *>(ptr);
+                    ptr += sizeof(struct inotify_event) + event->len;
+
+                    if (event->mask & IN_Q_OVERFLOW)
+                    {
+                        changes.push_back({ _root, true });
+                        continue;
+                    }
+                    auto watch = _watches.find(event->wd);
+                    if (watch == _watches.end()) continue;
+                    if (event->mask & IN_IGNORED)
+                    {
+                        _directories.erase(watch->second);
+                        _watches.erase(watch);
+                        continue;
+                    }
+                    if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+                    {
+                        if (watch->second == _root) changes.push_back({ _root, true });
+                        continue;
+                    }
+                    if (event->len == 0) continue;
+
+                    auto p = watch->second / event->name;
+                    if (!(event->mask & IN_ISDIR))
+                    {
+                        changes.push_back({ p, false });
+                        continue;
+                    }
+                    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) _remove_tree(p);
+                    if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && _recurse)
+                    {
+                        boost::system::error_code ec;
+                        if (!_skip_hidden || !is_hidden(p, ec)) _add_tree(p);
+                    }
+                    if (event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) changes.push_back({ p, true });
+                }
+            }
+        }
+
+        void _read_fanotify(std::vector<file_change>& changes)
+        {
+#if defined(FAN_REPORT_DFID_NAME) && defined(FAN_MARK_FILESYSTEM)
+            alignas(struct fanotify_event_metadata) char buffer[65536];
+            for (;;)
+            {
+                auto length = read(_fd, buffer, sizeof(buffer));
+                if (length <= 0)
+                {
+                    if ((length < 0) && (errno != EAGAIN) && (errno != EINTR)) throw std::system_error(errno, std::generic_category());
+                    return;
+                }
+
+                auto event = reinterpret_cast<const struct fanotify_event_metadata *>(buffer);
+                for (; FAN_EVENT_OK(event, length); event = FAN_EVENT_NEXT(event, length))
+                {
+                    if (event->mask & FAN_Q_OVERFLOW)
+                    {
+                        changes.push_back({ _root, true });
+                        continue;
+                    }
+
+                    auto info = reinterpret_cast<const struct fanotify_event_info_fid *>(event + 1);
+                    if ((event->event_len <= event->metadata_len) || (info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)) continue;
+                    auto handle = reinterpret_cast<const struct file_handle *>(info->handle);
+                    const char *name = reinterpret_cast<const char *>(handle->f_handle + handle->handle_bytes);
+                    std::string key(reinterpret_cast<const char *>(&handle->handle_type), sizeof(handle->handle_type));
+                    key.append(reinterpret_cast<const char *>(handle->f_handle), handle->handle_bytes);
+
+                    // The event names the directory by its handle, which has to be opened to find its path. A directory
+                    // that has gone since cannot be opened, but its removal is reported by its own parent.
+                    auto known = _handles.find(key);
+                    if (known == _handles.end())
+                    {
+                        int dir = open_by_handle_at(_mount, const_cast<struct file_handle *>(handle), O_PATH | O_CLOEXEC);
+                        if (dir < 0) continue;
+                        char target[4096];
+                        auto link = "/proc/self/fd/" + std::to_string(dir);
+                        auto target_length = readlink(link.c_str(), target, sizeof(target) - 1);
+                        close(dir);
+                        if (target_length <= 0) continue;
+                        boost::filesystem::path resolved(std::string(target, static_cast<std::size_t>(target_length)));
+                        known = _handles.emplace(key, resolved).first;
+                        _handle_paths[resolved] = key;
+                    }
+                    auto parent = known->second;
+                    if (_recurse ? !is_within(parent, _root) : (parent != _root)) continue;
+                    if (std::strcmp(name, ".") == 0)
+                    {
+                        if (parent == _root) changes.push_back({ _root, true });
+                        continue;
+                    }
+                    auto p = parent / name;
+                    if (!(event->mask & FAN_ONDIR))
+                    {
+                        changes.push_back({ p, false });
+                    }
+                    else if (event->mask & (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO))
+                    {
+                        // The paths of the directory and everything below it are no longer known.
+                        for (auto it = _handle_paths.lower_bound(p); (it != _handle_paths.end()) && is_within(it->first, p);)
+                        {
+                            _handles.erase(it->second);
+                            it = _handle_paths.erase(it);
+                        }
+                        changes.push_back({ p, true });
+                    }
+                }
+            }
+#endif
+        }
+
+    public:
+
+        /**********************************************************************************************//**
+         * @fn	file_watcher::file_watcher(const boost::filesystem::path& root, bool recurse, bool skip_hidden, const std::function<void(const boost::filesystem::path&, const std::error_condition&)>& error_callback = nullptr)
+         *
+         * @brief	Starts watching a directory.
+         *
+         * @exception	std::system_error	Thrown if the directory cannot be watched.
+         *
+         * @param 	root		  	The directory to watch, it must be a canonical path.
+         * @param 	recurse		  	True to watch the whole tree below the directory.
+         * @param 	skip_hidden   	True to leave hidden directories unwatched where each directory is
+         * 							watched separately.
+         * @param 	error_callback	(Optional) Called with directories that could not be watched.
+         **************************************************************************************************/
+
+        file_watcher(const boost::filesystem::path& root, bool recurse, bool skip_hidden, const std::function<void(const boost::filesystem::path&, const std::error_condition&)>& error_callback = nullptr)
+            : _root(root), _recurse(recurse), _skip_hidden(skip_hidden), _fd(-1), _wake(-1), _mount(-1), _fanotify(false), _error_callback(error_callback)
+        {
+            _wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            if (_wake < 0) throw std::system_error(errno, std::generic_category());
+            if (_start_fanotify()) return;
+
+            _fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+            if (_fd < 0)
+            {
+                auto error = errno;
+                close(_wake);
+                throw std::system_error(error, std::generic_category());
+            }
+            _add_tree(_root);
+            if (_watches.empty())
+            {
+                close(_fd);
+                close(_wake);
+                throw std::system_error(ENOENT, std::generic_category());
+            }
+        }
+
+        file_watcher(const file_watcher&) = delete;
+
+        file_watcher& operator=(const file_watcher&) = delete;
+
+        ~file_watcher()
+        {
+            if (_fd >= 0) close(_fd);
+            if (_mount >= 0) close(_mount);
+            if (_wake >= 0) close(_wake);
+        }
+
+        [[nodiscard]] bool uses_fanotify() const noexcept
+        {
+            return _fanotify;
+        }
+
+        /**********************************************************************************************//**
+         * @fn	bool file_watcher::wait(std::vector<file_change>& changes, std::chrono::milliseconds timeout)
+         *
+         * @brief	Waits for changes.
+         *
+         * @exception	std::system_error	Thrown if the events cannot be read.
+         *
+         * @param [in,out]	changes	The changes are appended to this.
+         * @param 		  	timeout	How long to wait for the first change, a negative value waits for ever.
+         *
+         * @returns	false once stop() has been called; otherwise true, even if nothing changed.
+         **************************************************************************************************/
+
+        bool wait(std::vector<file_change>& changes, std::chrono::milliseconds timeout)
+        {
+            struct pollfd fds[2] = { { _fd, POLLIN, 0 }, { _wake, POLLIN, 0 } };
+            auto ready = poll(fds, 2, (timeout.count() < 0) ? -1 : static_cast<int>(std::min<int64_t>(timeout.count(), INT32_MAX)));
+            if (ready < 0)
+            {
+                if (errno == EINTR) return true;
+                throw std::system_error(errno, std::generic_category());
+            }
+            if (fds[1].revents & POLLIN) return false;
+            if (fds[0].revents & POLLIN)
+            {
+                if (_fanotify)
+                {
+                    _read_fanotify(changes);
+                }
+                else
+                {
+                    _read_inotify(changes);
+                }
+            }
+
+            return true;
+        }
+
+        // Makes wait() return false, it may be called from any thread.
+        void stop() noexcept
+        {
+            uint64_t one = 1;
+            auto written = write(_wake, &one, sizeof(one));
+            (void)written;
+        }
+    };
+}
+
+#endif
+
+#endif //_FILE_WATCHER_HPP_
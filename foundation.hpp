@@ -4,6 +4,8 @@
 #include <map>
 #include <set>
 #include <string>
+#include <compare>
+#include <cstdint>
 #include <boost/algorithm/string.hpp>
 #include <boost/regex.h>
 #include <fmt/format.h>
@@ -17,7 +19,11 @@
 #include <windows.h>
 #include "win32_error.hpp"
 #else
+#include <fcntl.h>
 #include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/sysmacros.h>
+#endif
 #endif
 
 #ifndef _BASE_HPP_
@@ -572,6 +578,157 @@ namespace oasis
             return ss.str();
         }
 
+        // The device and inode of a file, paths with the same known identity are hard links to the same data.
+        struct file_identity
+        {
+            uintmax_t device = 0;
+            uintmax_t inode = 0;
+
+            [[nodiscard]] bool known() const noexcept
+            {
+                return (inode != 0);
+            }
+
+            auto operator<=>(const file_identity&) const = default;
+        };
+
+        // The last modification and status change times of a file, in nanoseconds since the epoch.
+        struct file_times
+        {
+            int64_t modified = 0;
+            int64_t changed = 0;
+
+            auto operator<=>(const file_times&) const = default;
+        };
+
+        inline file_identity identity(const boost::filesystem::path& p, uintmax_t& size, file_times& times, boost::system::error_code& ec) noexcept
+        {
+            file_identity id;
+            ec.clear();
+#if defined(_MSC_VER)
+            size = boost::filesystem::file_size(p, ec);
+            if (!ec) times.modified = static_cast<int64_t>(boost::filesystem::last_write_time(p, ec)) * 1000000000;
+            times.changed = times.modified;
+#else
+            struct stat buff{};
+            if (stat(p.string().c_str(), &buff) != 0)
+            {
+                ec = boost::system::error_code(errno, boost::system::system_category());
+                return id;
+            }
+            size = static_cast<uintmax_t>(buff.st_size);
+            id.device = static_cast<uintmax_t>(buff.st_dev);
+            id.inode = static_cast<uintmax_t>(buff.st_ino);
+            times.modified = (static_cast<int64_t>(buff.st_mtim.tv_sec) * 1000000000) + buff.st_mtim.tv_nsec;
+            times.changed = (static_cast<int64_t>(buff.st_ctim.tv_sec) * 1000000000) + buff.st_ctim.tv_nsec;
+#endif
+
+            return id;
+        }
+
+#if !defined(_MSC_VER)
+        // The same, for a file that is already open.
+        inline file_identity identity(int fd, uintmax_t& size, file_times& times, boost::system::error_code& ec) noexcept
+        {
+            file_identity id;
+            ec.clear();
+            struct stat buff{};
+            if (fstat(fd, &buff) != 0)
+            {
+                ec = boost::system::error_code(errno, boost::system::system_category());
+                return id;
+            }
+            size = static_cast<uintmax_t>(buff.st_size);
+            id.device = static_cast<uintmax_t>(buff.st_dev);
+            id.inode = static_cast<uintmax_t>(buff.st_ino);
+            times.modified = (static_cast<int64_t>(buff.st_mtim.tv_sec) * 1000000000) + buff.st_mtim.tv_nsec;
+            times.changed = (static_cast<int64_t>(buff.st_ctim.tv_sec) * 1000000000) + buff.st_ctim.tv_nsec;
+
+            return id;
+        }
+#endif
+
+        // What one look at a directory entry tells about it, it travels with the file so it is not examined again.
+        struct entry_status
+        {
+            file_identity id;
+            uintmax_t size = 0;
+            file_times times;
+            uint32_t mode = 0;
+            bool valid = false;
+        };
+
+#if !defined(_MSC_VER)
+        // Examines an entry of an open directory without following a link, with statx where the system has it.
+        inline bool status_at(int dirfd, const char *name, entry_status& status, boost::system::error_code& ec) noexcept
+        {
+            ec.clear();
+#if defined(__linux__) && defined(STATX_BASIC_STATS)
+            struct statx buff{};
+            if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME, &buff) != 0)
+            {
+                ec = boost::system::error_code(errno, boost::system::system_category());
+                return false;
+            }
+            status.id.device = static_cast<uintmax_t>(makedev(buff.stx_dev_major, buff.stx_dev_minor));
+            status.id.inode = static_cast<uintmax_t>(buff.stx_ino);
+            status.size = static_cast<uintmax_t>(buff.stx_size);
+            status.times.modified = (static_cast<int64_t>(buff.stx_mtime.tv_sec) * 1000000000) + buff.stx_mtime.tv_nsec;
+            status.times.changed = (static_cast<int64_t>(buff.stx_ctime.tv_sec) * 1000000000) + buff.stx_ctime.tv_nsec;
+            status.mode = buff.stx_mode;
+#else
+            struct stat buff{};
+            if (fstatat(dirfd, name, &buff, AT_SYMLINK_NOFOLLOW) != 0)
+            {
+                ec = boost::system::error_code(errno, boost::system::system_category());
+                return false;
+            }
+            status.id.device = static_cast<uintmax_t>(buff.st_dev);
+            status.id.inode = static_cast<uintmax_t>(buff.st_ino);
+            status.size = static_cast<uintmax_t>(buff.st_size);
+            status.times.modified = (static_cast<int64_t>(buff.st_mtim.tv_sec) * 1000000000) + buff.st_mtim.tv_nsec;
+            status.times.changed = (static_cast<int64_t>(buff.st_ctim.tv_sec) * 1000000000) + buff.st_ctim.tv_nsec;
+            status.mode = buff.st_mode;
+#endif
+            status.valid = true;
+
+            return true;
+        }
+#endif
+
+        inline file_identity identity(const boost::filesystem::path& p, uintmax_t& size, boost::system::error_code& ec) noexcept
+        {
+            file_identity id;
+            ec.clear();
+#if defined(_MSC_VER)
+            size = boost::filesystem::file_size(p, ec);
+#else
+            struct stat buff{};
+            if (stat(p.string().c_str(), &buff) != 0)
+            {
+                ec = boost::system::error_code(errno, boost::system::system_category());
+                return id;
+            }
+            size = static_cast<uintmax_t>(buff.st_size);
+            id.device = static_cast<uintmax_t>(buff.st_dev);
+            id.inode = static_cast<uintmax_t>(buff.st_ino);
+#endif
+
+            return id;
+        }
+
+        // Whether a path is a directory or lies below it, compared element by element without touching the disk.
+        inline bool is_within(const boost::filesystem::path& p, const boost::filesystem::path& dir)
+        {
+            auto e = p.begin();
+            for (auto d = dir.begin(); d != dir.end(); ++d, ++e)
+            {
+                if ((e == p.end()) || (*e != *d)) return false;
+            }
+
+            return true;
+        }
+
         bool is_hidden(const boost::filesystem::path& p)
         {
             if (p.empty()) throw std::invalid_argument("The given path was empty.");
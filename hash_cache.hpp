@@ -0,0 +1,476 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include "foundation.hpp"
+#include "digest_key.hpp"
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifndef _HASH_CACHE_HPP_
+#define _HASH_CACHE_HPP_
+
+namespace oasis::filesystem
+{
+    /**********************************************************************************************//**
+     * @class	hash_cache hash_cache.hpp
+     *
+     * @brief	A persistent cache of file digests, keyed by the device and inode of each file and
+     * 			only trusted while its size, modification time and status change time are unchanged.
+     *
+     * 			The cache file is a 64 byte header naming the hash algorithm followed by fixed size
+     * 			128 byte records, so it can be memory mapped and read in place. Records are only ever
+     * 			appended, a later record for an inode replaces any earlier one. Every record carries a
+     * 			checksum: a record torn by a crash fails it, loading stops there and the torn tail is
+     * 			cut off before anything new is written. New records are buffered and written in
+     * 			batches, flush() writes them and waits for the data to reach the disk.
+     *
+     * 			compact() rewrites the file with one record per inode into a temporary file and then
+     * 			renames it over the original, so the cache is never left half written.
+     *
+     * 			The object is safe to use from several threads, but only one process may write to a
+     * 			cache file at a time.
+     **************************************************************************************************/
+
+    class hash_cache
+    {
+    private:
+        static constexpr char _magic[8] = { 'O', 'A', 'S', 'I', 'S', 'H', 'C', '1' };
+        static constexpr uint32_t _version = 1;
+        static constexpr std::size_t _flush_threshold = 256;
+
+        struct _header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t record_size;
+            char algorithm[40];
+            uint64_t checksum;
+        };
+
+        struct _record
+        {
+            uint64_t device;
+            uint64_t inode;
+            uint64_t size;
+            int64_t modified;
+            int64_t changed;
+            uint8_t length;
+            uint8_t reserved[15];
+            uint8_t digest[digest_key::capacity];
+            uint64_t checksum;
+        };
+
+        static_assert(sizeof(_header) == 64, "The cache header must be 64 bytes");
+        static_assert(sizeof(_record) == 128, "A cache record must be 128 bytes");
+
+        struct _entry
+        {
+            uintmax_t size;
+            file_times times;
+            digest_key key;
+            bool used;
+        };
+
+        struct _identity_hash
+        {
+            std::size_t operator()(const file_identity& id) const noexcept
+            {
+                uint64_t h = (static_cast<uint64_t>(id.device) * 0x9E3779B97F4A7C15ULL) ^ static_cast<uint64_t>(id.inode);
+                h ^= h >> 31;
+                return static_cast<std::size_t>(h * 0xBF58476D1CE4E5B9ULL);
+            }
+        };
+
+        boost::filesystem::path _path;
+        std::string _algorithm;
+        boost::mutex _lock;
+        std::unordered_map<file_identity, _entry, _identity_hash> _entries;
+        std::vector<_record> _pending;
+        FILE *_file;
+        uintmax_t _records;
+        uintmax_t _hits;
+        uintmax_t _misses;
+        uintmax_t _invalidations;
+
+        static uint64_t _checksum(const void *data, std::size_t length) noexcept
+        {
+            auto bytes = static_cast<const uint8_t *>(data);
+            uint64_t h = 0xcbf29ce484222325ULL;
+            for (std::size_t i = 0; i < length; i++)
+            {
+                h = (h ^ bytes[i]) * 0x100000001b3ULL;
+            }
+
+            return h;
+        }
+
+        _header _make_header() const
+        {
+            _header h{};
+            std::memcpy(h.magic, _magic, sizeof(_magic));
+            h.version = _version;
+            h.record_size = sizeof(_record);
+            std::strncpy(h.algorithm, _algorithm.c_str(), sizeof(h.algorithm) - 1);
+            h.checksum = _checksum(&h, offsetof(_header, checksum));
+
+            return h;
+        }
+
+        static _record _make_record(const file_identity& id, const _entry& e)
+        {
+            _record r{};
+            r.device = id.device;
+            r.inode = id.inode;
+            r.size = e.size;
+            r.modified = e.times.modified;
+            r.changed = e.times.changed;
+            r.length = static_cast<uint8_t>(e.key.length());
+            std::memcpy(r.digest, e.key.data(), e.key.length());
+            r.checksum = _checksum(&r, offsetof(_record, checksum));
+
+            return r;
+        }
+
+        static FILE *_open(const boost::filesystem::path& p, const char *mode)
+        {
+#if defined (_MSC_VER)
+            std::wstring wmode(mode, mode + std::strlen(mode));
+            FILE *file = _wfopen(p.wstring().c_str(), wmode.c_str());
+#else
+            FILE *file = fopen64(p.string().c_str(), mode);
+#endif
+            if (file == nullptr) throw std::system_error(errno, std::generic_category());
+
+            return file;
+        }
+
+        static void _sync(FILE *file)
+        {
+            if (fflush(file) != 0) throw std::system_error(errno, std::generic_category());
+#if defined (_MSC_VER)
+            _commit(_fileno(file));
+#else
+            fsync(fileno(file));
+#endif
+        }
+
+        // Reads every valid record of the file and returns the length of the valid part, or zero if the header is unusable.
+        uintmax_t _load()
+        {
+            boost::system::error_code ec;
+            auto length = boost::filesystem::file_size(_path, ec);
+            if (ec || (length < sizeof(_header))) return 0;
+
+            std::vector<uint8_t> copy;
+            const uint8_t *data = nullptr;
+#if __has_include(<sys/mman.h>)
+            int fd = open(_path.string().c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) throw std::system_error(errno, std::generic_category());
+            void *map = mmap(nullptr, static_cast<std::size_t>(length), PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (map == MAP_FAILED) throw std::system_error(errno, std::generic_category());
+            madvise(map, static_cast<std::size_t>(length), MADV_SEQUENTIAL);
+            data = static_cast<const uint8_t *>(map);
+#else
+            FILE *file = _open(_path, "rb");
+            copy.resize(static_cast<std::size_t>(length));
+            length = fread(copy.data(), 1, copy.size(), file);
+            fclose(file);
+            data = copy.data();
+#endif
+
+            uintmax_t valid = 0;
+            _header h{};
+            std::memcpy(&h, data, sizeof(h));
+            auto expected = _make_header();
+            if ((std::memcmp(h.magic, _magic, sizeof(_magic)) == 0) && (h.checksum == _checksum(&h, offsetof(_header, checksum))))
+            {
+                if ((h.version != _version) || (h.record_size != sizeof(_record)))
+                {
+                    valid = 0;
+                }
+                else if (std::memcmp(h.algorithm, expected.algorithm, sizeof(h.algorithm)) != 0)
+                {
+#if __has_include(<sys/mman.h>)
+                    munmap(map, static_cast<std::size_t>(length));
+#endif
+                    throw std::invalid_argument("The cache was built with a different hash algorithm");
+                }
+                else
+                {
+                    valid = sizeof(_header);
+                    while (valid + sizeof(_record) <= length)
+                    {
+                        _record r;
+                        std::memcpy(&r, data + valid, sizeof(r));
+                        if ((r.checksum != _checksum(&r, offsetof(_record, checksum))) || (r.length > digest_key::capacity)) break;
+                        file_identity id{ r.device, r.inode };
+                        _entries[id] = _entry{ r.size, file_times{ r.modified, r.changed }, digest_key(r.size, r.digest, r.length), false };
+                        _records++;
+                        valid += sizeof(_record);
+                    }
+                }
+            }
+
+#if __has_include(<sys/mman.h>)
+            munmap(map, static_cast<std::size_t>(length));
+#endif
+            return valid;
+        }
+
+        void _write_pending()
+        {
+            if (_pending.empty()) return;
+            if (fwrite(_pending.data(), sizeof(_record), _pending.size(), _file) != _pending.size()) throw std::system_error(errno, std::generic_category());
+            _records += _pending.size();
+            _pending.clear();
+        }
+
+    public:
+
+        /**********************************************************************************************//**
+         * @fn	hash_cache::hash_cache(const boost::filesystem::path& p, const std::string& algorithm)
+         *
+         * @brief	Opens a cache file, creating it if it does not exist.
+         *
+         * 			A file that is not a cache, or was written by another version of this class, is
+         * 			replaced with an empty cache.
+         *
+         * @exception	std::invalid_argument	Thrown if the file is a cache of digests made with a
+         * 										different algorithm.
+         * @exception	std::system_error	 	Thrown if the file cannot be read or written.
+         *
+         * @param 	p		 	The path of the cache file.
+         * @param 	algorithm	The name of the hash algorithm, as returned by the name() function of
+         * 						the hash policy.
+         **************************************************************************************************/
+
+        hash_cache(const boost::filesystem::path& p, const std::string& algorithm) : _path(p), _algorithm(algorithm)
+        {
+            _file = nullptr;
+            _records = 0;
+            _hits = 0;
+            _misses = 0;
+            _invalidations = 0;
+
+            auto valid = _load();
+            if (valid == 0)
+            {
+                _entries.clear();
+                _records = 0;
+                _file = _open(_path, "wb");
+                auto h = _make_header();
+                if (fwrite(&h, sizeof(h), 1, _file) != 1) throw std::system_error(errno, std::generic_category());
+                _sync(_file);
+                return;
+            }
+
+            // Cut off anything after the last valid record, a torn record must not sit between good ones.
+            boost::system::error_code ec;
+            if (boost::filesystem::file_size(_path, ec) != valid) boost::filesystem::resize_file(_path, valid);
+            _file = _open(_path, "ab");
+        }
+
+        hash_cache(const hash_cache&) = delete;
+
+        hash_cache& operator=(const hash_cache&) = delete;
+
+        ~hash_cache()
+        {
+            try
+            {
+                flush();
+            }
+            catch (...)
+            {
+            }
+            if (_file != nullptr) fclose(_file);
+        }
+
+        [[nodiscard]] const std::string& algorithm() const noexcept
+        {
+            return _algorithm;
+        }
+
+        [[nodiscard]] const boost::filesystem::path& path() const noexcept
+        {
+            return _path;
+        }
+
+        /**********************************************************************************************//**
+         * @fn	bool hash_cache::find(const file_identity& id, uintmax_t size, const file_times& times, digest_key& key)
+         *
+         * @brief	Looks up the digest of a file.
+         *
+         * @param 	   	id   	The device and inode of the file.
+         * @param 	   	size 	The current size of the file.
+         * @param 	   	times	The current modification and status change times of the file.
+         * @param [out]	key  	Receives the cached digest.
+         *
+         * @returns	true if a digest is cached and the file has not changed since; otherwise false. A
+         * 			cached digest for a file that has since changed counts as an invalidation, rather
+         * 			than a miss.
+         **************************************************************************************************/
+
+        bool find(const file_identity& id, uintmax_t size, const file_times& times, digest_key& key)
+        {
+            boost::lock_guard<boost::mutex> guard(_lock);
+            auto it = _entries.find(id);
+            if (it == _entries.end())
+            {
+                _misses++;
+                return false;
+            }
+            if ((it->second.size != size) || (it->second.times != times))
+            {
+                _invalidations++;
+                return false;
+            }
+            _hits++;
+            it->second.used = true;
+            key = it->second.key;
+
+            return true;
+        }
+
+        /**********************************************************************************************//**
+         * @fn	void hash_cache::store(const file_identity& id, uintmax_t size, const file_times& times, const digest_key& key)
+         *
+         * @brief	Records the digest of a file, as it was when it was examined before being read.
+         **************************************************************************************************/
+
+        void store(const file_identity& id, uintmax_t size, const file_times& times, const digest_key& key)
+        {
+            if (!id.known()) return;
+            boost::lock_guard<boost::mutex> guard(_lock);
+            _entry e{ size, times, key, true };
+            _entries[id] = e;
+            _pending.push_back(_make_record(id, e));
+            if (_pending.size() >= _flush_threshold) _write_pending();
+        }
+
+        /**********************************************************************************************//**
+         * @fn	void hash_cache::flush()
+         *
+         * @brief	Writes any buffered records and waits for them to reach the disk.
+         **************************************************************************************************/
+
+        void flush()
+        {
+            boost::lock_guard<boost::mutex> guard(_lock);
+            if (_file == nullptr) return;
+            _write_pending();
+            _sync(_file);
+        }
+
+        /**********************************************************************************************//**
+         * @fn	void hash_cache::compact(bool drop_unused = false)
+         *
+         * @brief	Rewrites the cache file with a single record for each inode.
+         *
+         * @param 	drop_unused	(Optional) True to also drop the entries that have not been found or
+         * 						stored since the cache was opened, which removes files that have been
+         * 						deleted once a full scan has been made.
+         **************************************************************************************************/
+
+        void compact(bool drop_unused = false)
+        {
+            boost::lock_guard<boost::mutex> guard(_lock);
+            _write_pending();
+            _sync(_file);
+
+            auto temp = _path;
+            temp += ".tmp";
+            FILE *out = _open(temp, "wb");
+            uintmax_t written = 0;
+            try
+            {
+                auto h = _make_header();
+                if (fwrite(&h, sizeof(h), 1, out) != 1) throw std::system_error(errno, std::generic_category());
+                for (auto it = _entries.begin(); it != _entries.end();)
+                {
+                    if (drop_unused && !it->second.used)
+                    {
+                        it = _entries.erase(it);
+                        continue;
+                    }
+                    auto r = _make_record(it->first, it->second);
+                    if (fwrite(&r, sizeof(r), 1, out) != 1) throw std::system_error(errno, std::generic_category());
+                    written++;
+                    ++it;
+                }
+                _sync(out);
+                fclose(out);
+            }
+            catch (...)
+            {
+                fclose(out);
+                boost::system::error_code ec;
+                boost::filesystem::remove(temp, ec);
+                throw;
+            }
+
+            fclose(_file);
+            _file = nullptr;
+            boost::filesystem::rename(temp, _path);
+#if !defined (_MSC_VER)
+            // Make the rename itself durable.
+            int dir = open(_path.parent_path().empty() ? "." : _path.parent_path().string().c_str(), O_RDONLY | O_CLOEXEC);
+            if (dir >= 0)
+            {
+                fsync(dir);
+                close(dir);
+            }
+#endif
+            _file = _open(_path, "ab");
+            _records = written;
+        }
+
+        // The number of distinct files in the cache.
+        [[nodiscard]] std::size_t size() noexcept
+        {
+            boost::lock_guard<boost::mutex> guard(_lock);
+            return _entries.size();
+        }
+
+        // The number of records in the file, including those replaced by later ones, which compact() removes.
+        [[nodiscard]] uintmax_t record_count() noexcept
+        {
+            boost::lock_guard<boost::mutex> guard(_lock);
+            return _records + _pending.size();
+        }
+
+        [[nodiscard]] uintmax_t hits() noexcept
+        {
+            boost::lock_guard<boost::mutex> guard(_lock);
+            return _hits;
+        }
+
+        [[nodiscard]] uintmax_t misses() noexcept
+        {
+            boost::lock_guard<boost::mutex> guard(_lock);
+            return _misses;
+        }
+
+        [[nodiscard]] uintmax_t invalidations() noexcept
+        {
+            boost::lock_guard<boost::mutex> guard(_lock);
+            return _invalidations;
+        }
+    };
+}
+
+#endif //_HASH_CACHE_HPP_
@@ -0,0 +1,238 @@
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <openssl/evp.h>
+#include <openssl/objects.h>
+#include <openssl/opensslv.h>
+#if __has_include(<blake3.h>)
+#include <blake3.h>
+#define OASIS_HAVE_BLAKE3
+#endif
+#if __has_include(<xxhash.h>)
+#include <xxhash.h>
+#define OASIS_HAVE_XXHASH
+#endif
+
+#ifndef _HASH_POLICIES_HPP_
+#define _HASH_POLICIES_HPP_
+
+namespace oasis
+{
+    /**********************************************************************************************//**
+     * @class	basic_evp_hash hash_policies.hpp
+     *
+     * @brief	A hash policy that computes a message digest with one of the algorithms provided by
+     * 			the OpenSSL EVP interface.
+     *
+     * 			Every hash policy exposes the same interface: a static \c digest_size member, a static
+     * 			name() function identifying the algorithm, and the reset(), update(), peek() and
+     * 			finish() member functions. peek() produces the digest of the data so far without ending
+     * 			the message, so more data may follow. A policy object owns its hashing context and may
+     * 			be reused for any number of messages by calling reset() before each one.
+     *
+     * 			The algorithm is looked up once per process. With OpenSSL 3 the functions such as
+     * 			EVP_sha512() return a placeholder that is resolved against the loaded providers on
+     * 			every EVP_DigestInit_ex() call, so the implementation is fetched explicitly and kept.
+     *
+     * @tparam	MdFn	The OpenSSL function returning the EVP_MD for the algorithm.
+     * @tparam	N   	The size of the digest produced by the algorithm, in bytes.
+     **************************************************************************************************/
+
+    template<const EVP_MD *(*MdFn)(), std::size_t N>
+    class basic_evp_hash
+    {
+    private:
+        EVP_MD_CTX *_ctx;
+
+        static const EVP_MD *_md()
+        {
+#if OPENSSL_VERSION_MAJOR >= 3
+            static const EVP_MD *md = []()
+            {
+                const EVP_MD *fetched = EVP_MD_fetch(nullptr, EVP_MD_get0_name(MdFn()), nullptr);
+                return (fetched == nullptr) ? MdFn() : fetched;
+            }();
+
+            return md;
+#else
+            return MdFn();
+#endif
+        }
+
+    public:
+        static constexpr std::size_t digest_size = N;
+
+        static std::string name()
+        {
+            return OBJ_nid2sn(EVP_MD_type(MdFn()));
+        }
+
+        basic_evp_hash()
+        {
+            _ctx = EVP_MD_CTX_new();
+            if (_ctx == nullptr) throw std::bad_alloc();
+            reset();
+        }
+
+        basic_evp_hash(const basic_evp_hash&) = delete;
+
+        basic_evp_hash& operator=(const basic_evp_hash&) = delete;
+
+        ~basic_evp_hash()
+        {
+            EVP_MD_CTX_free(_ctx);
+        }
+
+        void reset()
+        {
+            EVP_DigestInit_ex(_ctx, _md(), nullptr);
+        }
+
+        void update(const void *data, std::size_t length)
+        {
+            EVP_DigestUpdate(_ctx, data, length);
+        }
+
+        void peek(uint8_t *digest) const
+        {
+            EVP_MD_CTX *copy = EVP_MD_CTX_new();
+            if (copy == nullptr) throw std::bad_alloc();
+            EVP_MD_CTX_copy_ex(copy, _ctx);
+            EVP_DigestFinal_ex(copy, digest, nullptr);
+            EVP_MD_CTX_free(copy);
+        }
+
+        void finish(uint8_t *digest)
+        {
+            EVP_DigestFinal_ex(_ctx, digest, nullptr);
+        }
+    };
+
+    /// SHA-512, the default policy of the file scanners.
+    using sha512_hash = basic_evp_hash<EVP_sha512, 64>;
+
+    /// SHA-256, usually faster than SHA-512 on CPUs with the SHA extensions.
+    using sha256_hash = basic_evp_hash<EVP_sha256, 32>;
+
+    /// BLAKE2b-512, a fast cryptographic hash that is always available through OpenSSL.
+    using blake2b_hash = basic_evp_hash<EVP_blake2b512, 64>;
+
+#if defined(OASIS_HAVE_BLAKE3)
+
+    /**********************************************************************************************//**
+     * @class	blake3_hash hash_policies.hpp
+     *
+     * @brief	A hash policy computing the 256 bit BLAKE3 digest, only available when the BLAKE3
+     * 			library headers can be found.
+     **************************************************************************************************/
+
+    class blake3_hash
+    {
+    private:
+        blake3_hasher _hasher;
+    public:
+        static constexpr std::size_t digest_size = BLAKE3_OUT_LEN;
+
+        static std::string name()
+        {
+            return "BLAKE3";
+        }
+
+        blake3_hash()
+        {
+            reset();
+        }
+
+        void reset()
+        {
+            blake3_hasher_init(&_hasher);
+        }
+
+        void update(const void *data, std::size_t length)
+        {
+            blake3_hasher_update(&_hasher, data, length);
+        }
+
+        void peek(uint8_t *digest) const
+        {
+            blake3_hasher_finalize(&_hasher, digest, digest_size);
+        }
+
+        void finish(uint8_t *digest)
+        {
+            blake3_hasher_finalize(&_hasher, digest, digest_size);
+        }
+    };
+
+#endif
+
+#if defined(OASIS_HAVE_XXHASH)
+
+    /**********************************************************************************************//**
+     * @class	xxh3_128_hash hash_policies.hpp
+     *
+     * @brief	A hash policy computing the 128 bit XXH3 hash, only available when the xxHash library
+     * 			headers can be found.
+     *
+     * 			XXH3 is not a cryptographic hash, it is suitable for grouping files on trusted storage
+     * 			where speed matters more than resistance to deliberately crafted collisions.
+     **************************************************************************************************/
+
+    class xxh3_128_hash
+    {
+    private:
+        XXH3_state_t *_state;
+    public:
+        static constexpr std::size_t digest_size = sizeof(XXH128_canonical_t);
+
+        static std::string name()
+        {
+            return "XXH3-128";
+        }
+
+        xxh3_128_hash()
+        {
+            _state = XXH3_createState();
+            if (_state == nullptr) throw std::bad_alloc();
+            reset();
+        }
+
+        xxh3_128_hash(const xxh3_128_hash&) = delete;
+
+        xxh3_128_hash& operator=(const xxh3_128_hash&) = delete;
+
+        ~xxh3_128_hash()
+        {
+            XXH3_freeState(_state);
+        }
+
+        void reset()
+        {
+            XXH3_128bits_reset(_state);
+        }
+
+        void update(const void *data, std::size_t length)
+        {
+            XXH3_128bits_update(_state, data, length);
+        }
+
+        void peek(uint8_t *digest) const
+        {
+            XXH128_canonical_t canonical;
+            XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(_state));
+            std::memcpy(digest, canonical.digest, digest_size);
+        }
+
+        void finish(uint8_t *digest)
+        {
+            XXH128_canonical_t canonical;
+            XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(_state));
+            std::memcpy(digest, canonical.digest, digest_size);
+        }
+    };
+
+#endif
+}
+
+#endif //_HASH_POLICIES_HPP_
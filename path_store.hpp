@@ -0,0 +1,408 @@
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <span>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+#ifndef _PATH_STORE_HPP_
+#define _PATH_STORE_HPP_
+
+namespace oasis::filesystem
+{
+    /**********************************************************************************************//**
+     * @class	path_store path_store.hpp
+     *
+     * @brief	Holds a large number of paths compactly, each as a 32 bit id.
+     *
+     * 			Every component of a path is stored once, as a node that points to the node of its
+     * 			parent directory, with the names of all the nodes one after another in a single arena.
+     * 			A directory shared by thousands of files therefore costs its name once, and a file
+     * 			costs its own name and about twenty bytes. Nodes are found again through an open
+     * 			addressing table of ids, so adding a path that is already held returns the same id.
+     * 			The full path is only built when it is asked for.
+     *
+     * 			Nothing is ever removed until the store is cleared, a store that has gathered paths that
+     * 			are no longer wanted is built again from the ones that are. The store is not synchronised.
+     **************************************************************************************************/
+
+    class path_store
+    {
+    public:
+        using id_type = uint32_t;
+        using string_type = boost::filesystem::path::string_type;
+        using value_type = string_type::value_type;
+        using name_type = std::basic_string_view<value_type>;
+
+        static constexpr id_type none = std::numeric_limits<id_type>::max();
+
+    private:
+        // Names are kept in blocks that are never moved, a name never crosses from one block into the next.
+        static constexpr std::size_t _block_size = 262144;
+
+        struct _node
+        {
+            uint64_t offset;
+            id_type parent;
+            uint16_t length;
+        };
+
+        std::vector<std::unique_ptr<value_type[]>> _blocks;
+        uint64_t _used = 0;
+        std::deque<_node> _nodes;
+        std::vector<id_type> _slots;
+
+        static bool _is_separator(value_type c) noexcept
+        {
+            return (c == '/') || (c == boost::filesystem::path::preferred_separator);
+        }
+
+        static std::size_t _hash(id_type parent, name_type name) noexcept
+        {
+            uint64_t h = 14695981039346656037ULL ^ parent;
+            for (auto c : name)
+            {
+                h = (h ^ static_cast<uint64_t>(c)) * 1099511628211ULL;
+            }
+            return static_cast<std::size_t>(h ^ (h >> 32));
+        }
+
+        [[nodiscard]] name_type _name(const _node& n) const noexcept
+        {
+            return name_type(_blocks[n.offset / _block_size].get() + (n.offset % _block_size), n.length);
+        }
+
+        uint64_t _store_name(name_type name)
+        {
+            if (_used + name.size() > _blocks.size() * _block_size)
+            {
+                _blocks.push_back(std::make_unique_for_overwrite<value_type[]>(_block_size));
+                _used = (_blocks.size() - 1) * _block_size;
+            }
+            auto offset = _used;
+            std::copy(name.begin(), name.end(), _blocks.back().get() + (offset % _block_size));
+            _used += name.size();
+            return offset;
+        }
+
+        void _rehash(std::size_t slot_count)
+        {
+            std::vector<id_type> slots(slot_count, none);
+            for (id_type id = 0; id < _nodes.size(); id++)
+            {
+                auto i = _hash(_nodes[id].parent, _name(_nodes[id])) & (slot_count - 1);
+                while (slots[i] != none) i = (i + 1) & (slot_count - 1);
+                slots[i] = id;
+            }
+            _slots.swap(slots);
+        }
+
+        id_type _intern(id_type parent, name_type name, bool& created)
+        {
+            if (name.size() > std::numeric_limits<uint16_t>::max()) throw std::length_error("Path component is too long");
+
+            // The table is kept at most 3/4 full, so a search always ends at an empty slot.
+            if ((_nodes.size() + 1) * 4 > _slots.size() * 3) _rehash(_slots.empty() ? 1024 : _slots.size() * 2);
+
+            auto mask = _slots.size() - 1;
+            auto i = _hash(parent, name) & mask;
+            for (; _slots[i] != none; i = (i + 1) & mask)
+            {
+                const auto& n = _nodes[_slots[i]];
+                if ((n.parent == parent) && (_name(n) == name)) return _slots[i];
+            }
+
+            if (_nodes.size() >= none) throw std::length_error("Too many paths");
+            auto id = static_cast<id_type>(_nodes.size());
+            _nodes.push_back({ _store_name(name), parent, static_cast<uint16_t>(name.size()) });
+            _slots[i] = id;
+            created = true;
+            return id;
+        }
+
+    public:
+        path_store() = default;
+
+        path_store(const path_store& other) : _used(other._used), _nodes(other._nodes), _slots(other._slots)
+        {
+            for (const auto& block : other._blocks)
+            {
+                _blocks.push_back(std::make_unique_for_overwrite<value_type[]>(_block_size));
+                std::copy(block.get(), block.get() + _block_size, _blocks.back().get());
+            }
+        }
+
+        path_store(path_store&& other) noexcept = default;
+
+        path_store& operator=(const path_store& other)
+        {
+            if (this != &other) *this = path_store(other);
+            return *this;
+        }
+
+        path_store& operator=(path_store&& other) noexcept = default;
+
+        /**********************************************************************************************//**
+         * @fn	id_type path_store::add(const boost::filesystem::path& p, bool& created)
+         *
+         * @brief	Adds a path to the store, unless it is already held.
+         *
+         * @param 	   	p	   	The path, which should be absolute and normalised so that the same file
+         * 						is always added in the same form.
+         * @param [out]	created	Receives true if the path was not held before, and so cannot be
+         * 						referred to by any id that was given out earlier.
+         *
+         * @returns	The id of the path.
+         *
+         * @exception	std::invalid_argument	Thrown if \p p is empty.
+         * @exception	std::length_error	 	Thrown if the store cannot hold another 32 bit id.
+         **************************************************************************************************/
+
+        id_type add(const boost::filesystem::path& p, bool& created)
+        {
+            created = false;
+            const auto& s = p.native();
+            auto root = p.root_path().native().size();
+            if (s.empty()) throw std::invalid_argument("Invalid path");
+
+            // The root, separators and all, is the first component, the rest are split at the separators.
+            id_type id = none;
+            if (root > 0) id = _intern(none, name_type(s.data(), root), created);
+            for (auto first = root; first < s.size();)
+            {
+                if (_is_separator(s[first]))
+                {
+                    first++;
+                    continue;
+                }
+                auto last = first;
+                while ((last < s.size()) && !_is_separator(s[last])) last++;
+                created = false;
+                id = _intern(id, name_type(s.data() + first, last - first), created);
+                first = last;
+            }
+
+            return id;
+        }
+
+        id_type add(const boost::filesystem::path& p)
+        {
+            bool created;
+            return add(p, created);
+        }
+
+        /**********************************************************************************************//**
+         * @fn	boost::filesystem::path path_store::path(id_type id) const
+         *
+         * @brief	Builds the path that was given the specified id, in a single allocation.
+         *
+         * @exception	std::out_of_range	Thrown if \p id was not given out by this store.
+         **************************************************************************************************/
+
+        [[nodiscard]] boost::filesystem::path path(id_type id) const
+        {
+            if (id >= _nodes.size()) throw std::out_of_range("Invalid path id");
+
+            // Measure the path, then fill it in from the end. A separator goes between two components unless the
+            // first, which can only be the root, already ends with one.
+            std::size_t length = 0;
+            for (auto n = id; n != none; n = _nodes[n].parent)
+            {
+                length += _nodes[n].length;
+                auto parent = _nodes[n].parent;
+                if ((parent != none) && !_is_separator(_name(_nodes[parent]).back())) length++;
+            }
+
+            string_type s(length, value_type());
+            for (auto n = id; n != none; n = _nodes[n].parent)
+            {
+                const auto& node = _nodes[n];
+                auto name = _name(node);
+                length -= name.size();
+                std::copy(name.begin(), name.end(), s.begin() + length);
+                if ((node.parent != none) && !_is_separator(_name(_nodes[node.parent]).back())) s[--length] = boost::filesystem::path::preferred_separator;
+            }
+
+            return boost::filesystem::path(std::move(s));
+        }
+
+        // The number of paths and directories held.
+        [[nodiscard]] std::size_t size() const noexcept
+        {
+            return _nodes.size();
+        }
+
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return _nodes.empty();
+        }
+
+        // The memory taken by the store, in bytes.
+        [[nodiscard]] std::size_t memory_used() const noexcept
+        {
+            return (_blocks.size() * _block_size * sizeof(value_type)) + (_nodes.size() * sizeof(_node)) + (_slots.capacity() * sizeof(id_type));
+        }
+
+        void clear() noexcept
+        {
+            _blocks.clear();
+            _used = 0;
+            std::deque<_node>().swap(_nodes);
+            std::vector<id_type>().swap(_slots);
+        }
+    };
+
+    /**********************************************************************************************//**
+     * @class	path_set path_store.hpp
+     *
+     * @brief	A view of a set of files that are held as ids into a path_store. The path of each file
+     * 			is built as the set is iterated, so iterating yields paths by value.
+     *
+     * 			The view is only valid for as long as the ids and the store it was made from.
+     **************************************************************************************************/
+
+    class path_set
+    {
+    public:
+        using id_type = path_store::id_type;
+        using value_type = boost::filesystem::path;
+        using reference = value_type;
+        using const_reference = value_type;
+        using size_type = std::size_t;
+        using difference_type = std::ptrdiff_t;
+
+    private:
+        const path_store *_store;
+        std::span<const id_type> _ids;
+
+    public:
+        class const_iterator
+        {
+        private:
+            const path_store *_store;
+            const id_type *_at;
+
+        public:
+            typedef std::bidirectional_iterator_tag iterator_category;
+            typedef boost::filesystem::path value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef value_type reference;
+            typedef void pointer;
+
+            const_iterator() noexcept : _store(nullptr), _at(nullptr)
+            {
+            }
+
+            const_iterator(const path_store *store, const id_type *at) noexcept : _store(store), _at(at)
+            {
+            }
+
+            reference operator*() const
+            {
+                return _store->path(*_at);
+            }
+
+            // The id of the current file in the store, which is cheaper to compare or keep than its path.
+            [[nodiscard]] id_type id() const noexcept
+            {
+                return *_at;
+            }
+
+            bool operator==(const const_iterator& o) const noexcept
+            {
+                return _at == o._at;
+            }
+
+            bool operator!=(const const_iterator& o) const noexcept
+            {
+                return _at != o._at;
+            }
+
+            const_iterator& operator++() noexcept
+            {
+                ++_at;
+                return *this;
+            }
+
+            const_iterator operator++(int) noexcept
+            {
+                const_iterator x(*this);
+                ++_at;
+                return x;
+            }
+
+            const_iterator& operator--() noexcept
+            {
+                --_at;
+                return *this;
+            }
+
+            const_iterator operator--(int) noexcept
+            {
+                const_iterator x(*this);
+                --_at;
+                return x;
+            }
+        };
+
+        typedef const_iterator iterator;
+
+        path_set(const path_store *store, std::span<const id_type> ids) noexcept : _store(store), _ids(ids)
+        {
+        }
+
+        [[nodiscard]] const_iterator begin() const noexcept
+        {
+            return const_iterator(_store, _ids.data());
+        }
+
+        [[nodiscard]] const_iterator cbegin() const noexcept
+        {
+            return begin();
+        }
+
+        [[nodiscard]] const_iterator end() const noexcept
+        {
+            return const_iterator(_store, _ids.data() + _ids.size());
+        }
+
+        [[nodiscard]] const_iterator cend() const noexcept
+        {
+            return end();
+        }
+
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return _ids.empty();
+        }
+
+        [[nodiscard]] size_type size() const noexcept
+        {
+            return _ids.size();
+        }
+
+        [[nodiscard]] value_type operator[](size_type i) const
+        {
+            return _store->path(_ids[i]);
+        }
+
+        [[nodiscard]] value_type front() const
+        {
+            return _store->path(_ids.front());
+        }
+
+        // The ids of the files in the store, in the order of the set.
+        [[nodiscard]] std::span<const id_type> ids() const noexcept
+        {
+            return _ids;
+        }
+    };
+}
+
+#endif //_PATH_STORE_HPP_
@@ -0,0 +1,114 @@
+#include <atomic>
+#include <boost/thread.hpp>
+
+#ifndef _SCAN_CONTROL_HPP_
+#define _SCAN_CONTROL_HPP_
+
+namespace oasis
+{
+    /**********************************************************************************************//**
+     * @class	scan_control scan_control.hpp
+     *
+     * @brief	Lets another thread pause, resume or cancel a running scan.
+     *
+     * 			The threads of a scan look at the control at cheap points, such as before a directory
+     * 			or between two chunks of a file, so a request takes effect within one chunk. A paused
+     * 			thread first closes its files and returns its buffers, then blocks in wait() until the
+     * 			scan is resumed or cancelled. Work that has been queued stays queued.
+     *
+     * 			Cancellation cannot be undone, it lasts until reset() is called. One control may be
+     * 			shared by several scans to throttle them together.
+     **************************************************************************************************/
+
+    class scan_control
+    {
+    private:
+        boost::mutex _lock;
+        boost::condition_variable _changed;
+        std::atomic<bool> _paused;
+        std::atomic<bool> _cancelled;
+
+    public:
+        scan_control() noexcept : _paused(false), _cancelled(false)
+        {
+        }
+
+        scan_control(const scan_control&) = delete;
+
+        scan_control& operator=(const scan_control&) = delete;
+
+        void pause()
+        {
+            boost::lock_guard<boost::mutex> guard(_lock);
+            _paused = true;
+        }
+
+        void resume()
+        {
+            {
+                boost::lock_guard<boost::mutex> guard(_lock);
+                _paused = false;
+            }
+            _changed.notify_all();
+        }
+
+        void cancel()
+        {
+            {
+                boost::lock_guard<boost::mutex> guard(_lock);
+                _cancelled = true;
+            }
+            _changed.notify_all();
+        }
+
+        // Clears a cancellation and a pause, so the control can be used by another scan.
+        void reset()
+        {
+            {
+                boost::lock_guard<boost::mutex> guard(_lock);
+                _paused = false;
+                _cancelled = false;
+            }
+            _changed.notify_all();
+        }
+
+        [[nodiscard]] bool paused() const noexcept
+        {
+            return _paused.load(std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] bool cancelled() const noexcept
+        {
+            return _cancelled.load(std::memory_order_relaxed);
+        }
+
+        // True when a thread should let go of what it holds, because the scan has been paused or cancelled.
+        [[nodiscard]] bool interrupted() const noexcept
+        {
+            return paused() || cancelled();
+        }
+
+        /**********************************************************************************************//**
+         * @fn	bool scan_control::wait()
+         *
+         * @brief	Blocks while the scan is paused.
+         *
+         * @returns	false if the scan has been cancelled, true if it may go on.
+         **************************************************************************************************/
+
+        bool wait()
+        {
+            if (!interrupted()) return true;
+
+            boost::unique_lock<boost::mutex> guard(_lock);
+            while (_paused && !_cancelled)
+            {
+                _changed.wait(guard);
+            }
+
+            return !_cancelled;
+        }
+    };
+}
+
+#endif //_SCAN_CONTROL_HPP_
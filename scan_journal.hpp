@@ -0,0 +1,598 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include "foundation.hpp"
+#include "digest_key.hpp"
+#if !defined (_MSC_VER)
+#include <unistd.h>
+#endif
+
+#ifndef _SCAN_JOURNAL_HPP_
+#define _SCAN_JOURNAL_HPP_
+
+namespace oasis::filesystem
+{
+    /**********************************************************************************************//**
+     * @class	scan_journal scan_journal.hpp
+     *
+     * @brief	A record of the progress of a scan, from which a scan that was interrupted by a crash,
+     * 			a reboot or a cancellation can be resumed.
+     *
+     * 			The journal holds the directories that were queued and finished, the files found in
+     * 			them, and the digests of the head blocks and of the whole contents of the files that
+     * 			were read. A resumed scan walks only the directories that were not finished, and
+     * 			takes a digest from the journal whenever the device, inode, size and times of the
+     * 			file are unchanged, so it only reads the files that changed. Sets are rebuilt from
+     * 			those digests without reading anything.
+     *
+     * 			The file is a header followed by records that are only ever appended, each with its
+     * 			own checksum. A record torn by a crash fails it, loading stops there and the torn tail
+     * 			is cut off before anything new is written. Records are collected in memory and written
+     * 			in batches by whichever thread fills a batch, while the other threads go on adding to
+     * 			the next one. A batch is also written, and the file synced to the disk, once it has
+     * 			waited for sync_interval(), so a slow scan does not keep its progress in memory.
+     *
+     * 			All of the functions may be called from several threads at once, but only one process
+     * 			may use a journal file at a time.
+     **************************************************************************************************/
+
+    class scan_journal
+    {
+    private:
+        static constexpr char _magic[8] = { 'O', 'A', 'S', 'I', 'S', 'S', 'J', '1' };
+        static constexpr uint32_t _version = 1;
+        static constexpr std::size_t _batch_size = 262144;
+
+        enum class _kind : uint8_t
+        {
+            started = 1,
+            queued = 2,
+            finished = 3,
+            file = 4,
+            head = 5,
+            digest = 6,
+            completed = 7,
+        };
+
+        struct _entry
+        {
+            uintmax_t size;
+            file_times times;
+            digest_key key;
+        };
+
+        struct _identity_hash
+        {
+            std::size_t operator()(const file_identity& id) const noexcept
+            {
+                uint64_t h = (static_cast<uint64_t>(id.device) * 0x9E3779B97F4A7C15ULL) ^ static_cast<uint64_t>(id.inode);
+                h ^= h >> 31;
+                return static_cast<std::size_t>(h * 0xBF58476D1CE4E5B9ULL);
+            }
+        };
+
+        using digest_map_t = std::unordered_map<file_identity, _entry, _identity_hash>;
+
+        boost::filesystem::path _path;
+        boost::mutex _lock;
+        boost::mutex _write_lock;
+        std::string _batch;
+        FILE *_file;
+        std::chrono::seconds _sync_interval;
+        std::chrono::steady_clock::time_point _last_write;
+        std::chrono::steady_clock::time_point _last_sync;
+
+        // What was loaded from the file, and the directories queued since. Once a scan has added records it is stale,
+        // and loaded again before it is used to resume.
+        bool _stale;
+        boost::filesystem::path _root;
+        bool _recurse;
+        std::string _algorithm;
+        bool _completed;
+        std::unordered_set<std::string> _queued;
+        std::unordered_set<std::string> _finished;
+        std::vector<std::string> _files;
+        digest_map_t _heads;
+        digest_map_t _digests;
+
+        static std::string _key(const boost::filesystem::path& p)
+        {
+            const auto& native = p.native();
+            return std::string(reinterpret_cast<const char *>(native.data()), native.size() * sizeof(boost::filesystem::path::value_type));
+        }
+
+        static boost::filesystem::path _from_key(const std::string& key)
+        {
+            using char_t = boost::filesystem::path::value_type;
+            std::basic_string<char_t> native(key.size() / sizeof(char_t), char_t());
+            std::memcpy(native.data(), key.data(), native.size() * sizeof(char_t));
+            return boost::filesystem::path(native);
+        }
+
+        static uint64_t _checksum(const char *data, std::size_t length) noexcept
+        {
+            uint64_t h = 0xcbf29ce484222325ULL;
+            for (std::size_t i = 0; i < length; i++)
+            {
+                h = (h ^ static_cast<uint8_t>(data[i])) * 0x100000001b3ULL;
+            }
+
+            return h;
+        }
+
+        template <typename T>
+        static void _put(std::string& out, T value)
+        {
+            out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+
+        template <typename T>
+        static bool _get(const char *&in, const char *end, T& value)
+        {
+            if (static_cast<std::size_t>(end - in) < sizeof(value)) return false;
+            std::memcpy(&value, in, sizeof(value));
+            in += sizeof(value);
+            return true;
+        }
+
+        static void _put_file(std::string& out, const file_identity& id, uintmax_t size, const file_times& times, const digest_key& key)
+        {
+            _put(out, static_cast<uint64_t>(id.device));
+            _put(out, static_cast<uint64_t>(id.inode));
+            _put(out, static_cast<uint64_t>(size));
+            _put(out, times.modified);
+            _put(out, times.changed);
+            _put(out, static_cast<uint8_t>(key.length()));
+            out.append(reinterpret_cast<const char *>(key.data()), key.length());
+        }
+
+        static bool _get_file(const char *in, const char *end, digest_map_t& into)
+        {
+            uint64_t device = 0, inode = 0, size = 0;
+            file_times times;
+            uint8_t length = 0;
+            if (!_get(in, end, device) || !_get(in, end, inode) || !_get(in, end, size)) return false;
+            if (!_get(in, end, times.modified) || !_get(in, end, times.changed) || !_get(in, end, length)) return false;
+            if ((length > digest_key::capacity) || (static_cast<std::size_t>(end - in) != length)) return false;
+            into[file_identity{ device, inode }] = _entry{ size, times, digest_key(size, reinterpret_cast<const uint8_t *>(in), length) };
+            return true;
+        }
+
+        static FILE *_open(const boost::filesystem::path& p, const char *mode)
+        {
+#if defined (_MSC_VER)
+            std::wstring wmode(mode, mode + std::strlen(mode));
+            FILE *file = _wfopen(p.wstring().c_str(), wmode.c_str());
+#else
+            FILE *file = fopen64(p.string().c_str(), mode);
+#endif
+            if (file == nullptr) throw std::system_error(errno, std::generic_category());
+
+            return file;
+        }
+
+        static void _sync(FILE *file)
+        {
+            if (fflush(file) != 0) throw std::system_error(errno, std::generic_category());
+#if defined (_MSC_VER)
+            _commit(_fileno(file));
+#else
+            fsync(fileno(file));
+#endif
+        }
+
+        // Must be called with the lock held.
+        void _append(_kind kind, const std::string& payload)
+        {
+            auto start = _batch.size();
+            _put(_batch, static_cast<uint8_t>(kind));
+            _put(_batch, static_cast<uint32_t>(payload.size()));
+            _batch += payload;
+            _put(_batch, _checksum(_batch.data() + start, _batch.size() - start));
+        }
+
+        // Adds a record, and writes the batch if it is full or has waited for the sync interval, unless another thread
+        // is writing one.
+        void _add(_kind kind, const std::string& payload)
+        {
+            auto now = std::chrono::steady_clock::now();
+            boost::unique_lock<boost::mutex> guard(_lock);
+            _append(kind, payload);
+            if (((_batch.size() < _batch_size) && (now - _last_write < _sync_interval)) || !_write_lock.try_lock()) return;
+
+            _last_write = now;
+            std::string batch;
+            batch.swap(_batch);
+            guard.unlock();
+            boost::lock_guard<boost::mutex> writing(_write_lock, boost::adopt_lock);
+            _write(batch, false);
+        }
+
+        // Must be called with the write lock held. After a failure nothing more is written, so the records in the file
+        // are always a prefix of those that were added.
+        void _write(const std::string& batch, bool sync)
+        {
+            if (_file == nullptr) return;
+            try
+            {
+                if (!batch.empty() && (fwrite(batch.data(), 1, batch.size(), _file) != batch.size())) throw std::system_error(errno, std::generic_category());
+
+                auto now = std::chrono::steady_clock::now();
+                if (sync || (now - _last_sync >= _sync_interval))
+                {
+                    _sync(_file);
+                    _last_sync = now;
+                }
+            }
+            catch (...)
+            {
+                fclose(_file);
+                _file = nullptr;
+                throw;
+            }
+        }
+
+        // Reads every valid record of the file and returns the length of the valid part, or zero if the header is unusable.
+        uintmax_t _load()
+        {
+            boost::system::error_code ec;
+            auto length = boost::filesystem::file_size(_path, ec);
+            if (ec || (length < sizeof(_magic) + sizeof(uint32_t))) return 0;
+
+            FILE *file = _open(_path, "rb");
+            std::string data(static_cast<std::size_t>(length), '\0');
+            auto bytes_read = fread(data.data(), 1, data.size(), file);
+            fclose(file);
+            data.resize(bytes_read);
+
+            uint32_t version = 0;
+            if (data.size() < sizeof(_magic) + sizeof(version)) return 0;
+            std::memcpy(&version, data.data() + sizeof(_magic), sizeof(version));
+            if ((std::memcmp(data.data(), _magic, sizeof(_magic)) != 0) || (version != _version)) return 0;
+
+            std::size_t valid = sizeof(_magic) + sizeof(version);
+            for (;;)
+            {
+                const char *in = data.data() + valid;
+                const char *end = data.data() + data.size();
+                uint8_t kind = 0;
+                uint32_t size = 0;
+                uint64_t checksum = 0;
+                if (!_get(in, end, kind) || !_get(in, end, size) || (static_cast<std::size_t>(end - in) < size + sizeof(checksum))) break;
+                const char *payload = in;
+                in += size;
+                _get(in, end, checksum);
+                if (checksum != _checksum(data.data() + valid, sizeof(kind) + sizeof(size) + size)) break;
+
+                std::string text(payload, size);
+                bool parsed = true;
+                switch (static_cast<_kind>(kind))
+                {
+                    case _kind::started:
+                    {
+                        const char *p = payload;
+                        uint8_t recurse = 0;
+                        uint32_t root = 0;
+                        parsed = _get(p, payload + size, recurse) && _get(p, payload + size, root) && (root <= static_cast<std::size_t>(payload + size - p));
+                        if (parsed)
+                        {
+                            _recurse = (recurse != 0);
+                            _root = _from_key(std::string(p, root));
+                            _algorithm.assign(p + root, payload + size);
+                        }
+                        break;
+                    }
+                    case _kind::queued:
+                        _queued.insert(std::move(text));
+                        break;
+                    case _kind::finished:
+                        _finished.insert(std::move(text));
+                        break;
+                    case _kind::file:
+                        _files.push_back(std::move(text));
+                        break;
+                    case _kind::head:
+                        parsed = _get_file(payload, payload + size, _heads);
+                        break;
+                    case _kind::digest:
+                        parsed = _get_file(payload, payload + size, _digests);
+                        break;
+                    case _kind::completed:
+                        _completed = true;
+                        break;
+                    default:
+                        parsed = false;
+                        break;
+                }
+                if (!parsed) break;
+                valid = in - data.data();
+            }
+
+            return valid;
+        }
+
+        void _clear()
+        {
+            _stale = false;
+            _root.clear();
+            _recurse = false;
+            _algorithm.clear();
+            _completed = false;
+            _queued.clear();
+            _finished.clear();
+            _files.clear();
+            _heads.clear();
+            _digests.clear();
+        }
+
+    public:
+
+        /**********************************************************************************************//**
+         * @fn	explicit scan_journal::scan_journal(const boost::filesystem::path& p)
+         *
+         * @brief	Opens a journal file, creating it if it does not exist.
+         *
+         * 			A file that is not a journal, or was written by another version of this class, is
+         * 			replaced with an empty journal.
+         *
+         * @exception	std::system_error	Thrown if the file cannot be read or written.
+         *
+         * @param 	p	The path of the journal file.
+         **************************************************************************************************/
+
+        explicit scan_journal(const boost::filesystem::path& p) : _path(p)
+        {
+            _file = nullptr;
+            _sync_interval = std::chrono::seconds(30);
+            _last_write = std::chrono::steady_clock::now();
+            _last_sync = _last_write;
+            _clear();
+
+            auto valid = _load();
+            if (valid == 0)
+            {
+                _clear();
+                _file = _open(_path, "wb");
+                std::string header(_magic, sizeof(_magic));
+                _put(header, _version);
+                _write(header, true);
+                return;
+            }
+
+            // Cut off anything after the last valid record, a torn record must not sit between good ones.
+            boost::system::error_code ec;
+            if (boost::filesystem::file_size(_path, ec) != valid) boost::filesystem::resize_file(_path, valid);
+            _file = _open(_path, "ab");
+        }
+
+        scan_journal(const scan_journal&) = delete;
+
+        scan_journal& operator=(const scan_journal&) = delete;
+
+        ~scan_journal()
+        {
+            try
+            {
+                flush();
+            }
+            catch (...)
+            {
+            }
+            if (_file != nullptr) fclose(_file);
+        }
+
+        [[nodiscard]] const boost::filesystem::path& path() const noexcept
+        {
+            return _path;
+        }
+
+        // The longest time records wait in memory, and between two syncs of the file to the disk, while a scan is
+        // adding them. It bounds the work a crash can lose.
+        [[nodiscard]] std::chrono::seconds sync_interval() const noexcept
+        {
+            return _sync_interval;
+        }
+
+        void set_sync_interval(std::chrono::seconds value)
+        {
+            _sync_interval = value;
+        }
+
+        // Whether the journal holds an unfinished scan of the directory, made with the same options and hash algorithm.
+        [[nodiscard]] bool resumable(const boost::filesystem::path& root, bool recurse, const std::string& algorithm)
+        {
+            if (_completed) return false;
+            if (_stale)
+            {
+                flush();
+                boost::lock_guard<boost::mutex> guard(_lock);
+                _clear();
+                _load();
+            }
+
+            return !_completed && !_root.empty() && (_root == root) && (_recurse == recurse) && (_algorithm == algorithm);
+        }
+
+        /**********************************************************************************************//**
+         * @fn	void scan_journal::start(const boost::filesystem::path& root, bool recurse, const std::string& algorithm)
+         *
+         * @brief	Empties the journal and starts recording a new scan.
+         *
+         * @exception	std::system_error	Thrown if the file cannot be written.
+         **************************************************************************************************/
+
+        void start(const boost::filesystem::path& root, bool recurse, const std::string& algorithm)
+        {
+            boost::lock_guard<boost::mutex> writing(_write_lock);
+            boost::lock_guard<boost::mutex> guard(_lock);
+            if (_file != nullptr) fclose(_file);
+            _file = nullptr;
+            _clear();
+            _batch.clear();
+            _file = _open(_path, "wb");
+
+            _stale = true;
+            _root = root;
+            _recurse = recurse;
+            _algorithm = algorithm;
+            std::string payload;
+            auto key = _key(root);
+            _put(payload, static_cast<uint8_t>(recurse ? 1 : 0));
+            _put(payload, static_cast<uint32_t>(key.size()));
+            payload += key;
+            payload += algorithm;
+            std::string header(_magic, sizeof(_magic));
+            _put(header, _version);
+            _append(_kind::started, payload);
+            header += _batch;
+            _batch.clear();
+            _write(header, true);
+        }
+
+        // Records that the scan finished, so the journal is not resumed, and syncs it to the disk.
+        void complete()
+        {
+            {
+                boost::lock_guard<boost::mutex> guard(_lock);
+                _completed = true;
+                _append(_kind::completed, std::string());
+            }
+            flush();
+        }
+
+        /**********************************************************************************************//**
+         * @fn	bool scan_journal::queue(const boost::filesystem::path& dir)
+         *
+         * @brief	Records a directory that the scan is going to walk.
+         *
+         * @returns	false if the directory had already been queued, in which case it is walked from the
+         * 			place that queued it first.
+         **************************************************************************************************/
+
+        bool queue(const boost::filesystem::path& dir)
+        {
+            auto key = _key(dir);
+            {
+                boost::lock_guard<boost::mutex> guard(_lock);
+                if (!_queued.insert(key).second) return false;
+            }
+            _add(_kind::queued, key);
+            return true;
+        }
+
+        // Records a directory all of whose entries have been examined, after its files and sub-directories.
+        void finish(const boost::filesystem::path& dir)
+        {
+            _add(_kind::finished, _key(dir));
+        }
+
+        // Records a file that was found.
+        void add_file(const boost::filesystem::path& p)
+        {
+            _add(_kind::file, _key(p));
+        }
+
+        // Records the digest of the head block of a file, as it was when it was examined before being read.
+        void store_head(const file_identity& id, uintmax_t size, const file_times& times, const digest_key& key)
+        {
+            if (!id.known()) return;
+            std::string payload;
+            _put_file(payload, id, size, times, key);
+            _add(_kind::head, payload);
+        }
+
+        // Records the digest of the whole of a file, as it was when it was examined before being read.
+        void store_digest(const file_identity& id, uintmax_t size, const file_times& times, const digest_key& key)
+        {
+            if (!id.known()) return;
+            std::string payload;
+            _put_file(payload, id, size, times, key);
+            _add(_kind::digest, payload);
+        }
+
+        // Looks up the digest of the head block of a file that has not changed since the journal was written.
+        bool find_head(const file_identity& id, uintmax_t size, const file_times& times, digest_key& key) const
+        {
+            auto it = _heads.find(id);
+            if ((it == _heads.end()) || (it->second.size != size) || (it->second.times != times)) return false;
+            key = it->second.key;
+            return true;
+        }
+
+        // Looks up the digest of the whole of a file that has not changed since the journal was written.
+        bool find_digest(const file_identity& id, uintmax_t size, const file_times& times, digest_key& key) const
+        {
+            auto it = _digests.find(id);
+            if ((it == _digests.end()) || (it->second.size != size) || (it->second.times != times)) return false;
+            key = it->second.key;
+            return true;
+        }
+
+        // The directories that were queued but not finished, the walk of a resumed scan starts from these.
+        [[nodiscard]] std::vector<boost::filesystem::path> pending_directories() const
+        {
+            std::vector<boost::filesystem::path> pending;
+            if (!_queued.contains(_key(_root))) pending.push_back(_root);
+            for (const auto& dir : _queued)
+            {
+                if (!_finished.contains(dir)) pending.push_back(_from_key(dir));
+            }
+            std::sort(pending.begin(), pending.end());
+
+            return pending;
+        }
+
+        // The files found before the scan was interrupted.
+        [[nodiscard]] std::vector<boost::filesystem::path> files() const
+        {
+            std::vector<boost::filesystem::path> found;
+            found.reserve(_files.size());
+            for (const auto& p : _files)
+            {
+                found.push_back(_from_key(p));
+            }
+
+            return found;
+        }
+
+        // Frees the memory taken by what was loaded from the file, once a resumed scan no longer needs it.
+        void release()
+        {
+            boost::lock_guard<boost::mutex> guard(_lock);
+            std::vector<std::string>().swap(_files);
+            digest_map_t().swap(_heads);
+            digest_map_t().swap(_digests);
+            std::unordered_set<std::string>().swap(_finished);
+            _stale = true;
+        }
+
+        /**********************************************************************************************//**
+         * @fn	void scan_journal::flush()
+         *
+         * @brief	Writes any buffered records and waits for them to reach the disk.
+         **************************************************************************************************/
+
+        void flush()
+        {
+            boost::lock_guard<boost::mutex> writing(_write_lock);
+            std::string batch;
+            {
+                boost::lock_guard<boost::mutex> guard(_lock);
+                batch.swap(_batch);
+            }
+            _write(batch, true);
+        }
+    };
+}
+
+#endif //_SCAN_JOURNAL_HPP_
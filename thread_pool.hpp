@@ -0,0 +1,394 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#ifndef _THREAD_POOL_HPP_
+#define _THREAD_POOL_HPP_
+
+namespace oasis
+{
+    /**********************************************************************************************//**
+     * @fn	inline unsigned int default_concurrency()
+     *
+     * @brief	Determines how many threads this process can usefully keep busy.
+     *
+     * 			The result is the number of hardware threads, reduced to the number of CPUs in the
+     * 			affinity mask of the process and to the CPU quota of its control group (cgroup v2
+     * 			<tt>cpu.max</tt> or cgroup v1 <tt>cpu.cfs_quota_us</tt>), where these can be read.
+     *
+     * @returns	The number of threads to use, never less than one.
+     **************************************************************************************************/
+
+    inline unsigned int default_concurrency()
+    {
+        unsigned int count = boost::thread::hardware_concurrency();
+        if (count == 0) count = 1;
+
+#if defined(__linux__)
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        if (sched_getaffinity(0, sizeof(mask), &mask) == 0)
+        {
+            auto affinity = static_cast<unsigned int>(CPU_COUNT(&mask));
+            if ((affinity != 0) && (affinity < count)) count = affinity;
+        }
+
+        double quota = -1.0;
+        double period = 0.0;
+        std::ifstream v2("/sys/fs/cgroup/cpu.max");
+        if (v2)
+        {
+            std::string q;
+            v2 >> q >> period;
+            if (q != "max") quota = std::strtod(q.c_str(), nullptr);
+        }
+        else
+        {
+            std::ifstream v1q("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+            std::ifstream v1p("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+            if (v1q && v1p)
+            {
+                v1q >> quota;
+                v1p >> period;
+            }
+        }
+
+        if ((quota > 0.0) && (period > 0.0))
+        {
+            auto limit = static_cast<unsigned int>(std::ceil(quota / period));
+            if ((limit != 0) && (limit < count)) count = limit;
+        }
+#endif
+
+        return count;
+    }
+
+    /**********************************************************************************************//**
+     * @class	thread_pool thread_pool.hpp
+     *
+     * @brief	A fixed size pool of worker threads fed from a bounded queue.
+     *
+     * 			submit() blocks while the queue is full, which stops a fast producer from queueing
+     * 			unbounded amounts of work. A task that is submitted from one of the workers of the
+     * 			pool is never blocked: if the queue is full it runs immediately on the submitting
+     * 			worker, so tasks may safely schedule follow-on work.
+     *
+     * 			The first exception thrown by a task is captured and rethrown by wait().
+     **************************************************************************************************/
+
+    class thread_pool
+    {
+    private:
+        boost::thread_group _threads;
+        boost::mutex _lock;
+        boost::condition_variable _work_available;
+        boost::condition_variable _space_available;
+        boost::condition_variable _idle;
+        std::deque<std::function<void()>> _queue;
+        std::size_t _capacity;
+        std::size_t _active;
+        unsigned int _size;
+        bool _stopping;
+        std::exception_ptr _error;
+
+        static thread_pool *& _current() noexcept
+        {
+            static thread_local thread_pool *pool = nullptr;
+            return pool;
+        }
+
+        void _run(const std::function<void()>& task) noexcept
+        {
+            try
+            {
+                task();
+            }
+            catch (...)
+            {
+                boost::lock_guard<boost::mutex> guard(_lock);
+                if (!_error) _error = std::current_exception();
+            }
+        }
+
+        void _worker()
+        {
+            _current() = this;
+            for (;;)
+            {
+                std::function<void()> task;
+                {
+                    boost::unique_lock<boost::mutex> guard(_lock);
+                    while (_queue.empty() && !_stopping) _work_available.wait(guard);
+                    if (_queue.empty()) return;
+                    task = std::move(_queue.front());
+                    _queue.pop_front();
+                    _active++;
+                }
+                _space_available.notify_one();
+
+                _run(task);
+
+                {
+                    boost::lock_guard<boost::mutex> guard(_lock);
+                    _active--;
+                    if (_queue.empty() && (_active == 0)) _idle.notify_all();
+                }
+            }
+        }
+
+    public:
+
+        /**********************************************************************************************//**
+         * @fn	explicit thread_pool::thread_pool(unsigned int threads = 0, std::size_t capacity = 0)
+         *
+         * @brief	Creates a new pool and starts its worker threads.
+         *
+         * @param 	threads 	(Optional) The number of worker threads, zero selects
+         * 						default_concurrency().
+         * @param 	capacity	(Optional) The maximum number of queued tasks, zero selects 64 tasks per
+         * 						worker.
+         **************************************************************************************************/
+
+        explicit thread_pool(unsigned int threads = 0, std::size_t capacity = 0)
+        {
+            _size = (threads == 0) ? default_concurrency() : threads;
+            _capacity = (capacity == 0) ? (static_cast<std::size_t>(_size) * 64) : capacity;
+            _active = 0;
+            _stopping = false;
+            for (unsigned int i = 0; i < _size; i++)
+            {
+                _threads.create_thread([this]() { _worker(); });
+            }
+        }
+
+        thread_pool(const thread_pool&) = delete;
+
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        ~thread_pool()
+        {
+            {
+                boost::lock_guard<boost::mutex> guard(_lock);
+                _stopping = true;
+            }
+            _work_available.notify_all();
+            _threads.join_all();
+        }
+
+        [[nodiscard]] unsigned int size() const noexcept
+        {
+            return _size;
+        }
+
+        /**********************************************************************************************//**
+         * @fn	void thread_pool::submit(std::function<void()> task)
+         *
+         * @brief	Queues a task for execution by one of the workers, blocking while the queue is full
+         * 			unless called from a worker of this pool.
+         *
+         * @param 	task	The task to run.
+         **************************************************************************************************/
+
+        void submit(std::function<void()> task)
+        {
+            {
+                boost::unique_lock<boost::mutex> guard(_lock);
+                if (_queue.size() >= _capacity)
+                {
+                    if (_current() == this)
+                    {
+                        guard.unlock();
+                        _run(task);
+                        return;
+                    }
+                    while (_queue.size() >= _capacity) _space_available.wait(guard);
+                }
+                _queue.push_back(std::move(task));
+            }
+            _work_available.notify_one();
+        }
+
+        /**********************************************************************************************//**
+         * @fn	void thread_pool::wait()
+         *
+         * @brief	Blocks until the queue is empty and no task is running, including any tasks queued
+         * 			by other tasks while waiting.
+         *
+         * @exception	Rethrows the first exception thrown by a task since the last call to wait().
+         **************************************************************************************************/
+
+        void wait()
+        {
+            boost::unique_lock<boost::mutex> guard(_lock);
+            while (!_queue.empty() || (_active != 0)) _idle.wait(guard);
+            if (_error)
+            {
+                auto error = _error;
+                _error = nullptr;
+                std::rethrow_exception(error);
+            }
+        }
+    };
+
+    /**********************************************************************************************//**
+     * @class	work_stealing_queue thread_pool.hpp
+     *
+     * @brief	A set of per-worker double ended queues for recursive work, such as walking a
+     * 			directory tree, where processing one item produces more items.
+     *
+     * 			Each worker pushes and pops at the back of its own queue, so it works depth first on
+     * 			data that is still warm. A worker whose queue is empty steals from the front of
+     * 			another worker's queue, taking the oldest and usually largest piece of outstanding
+     * 			work. The queue knows the work is finished when every item that was pushed has been
+     * 			marked as done.
+     *
+     * @tparam	T	The type of the work items.
+     **************************************************************************************************/
+
+    template<typename T>
+    class work_stealing_queue
+    {
+    private:
+        struct _slot
+        {
+            boost::mutex lock;
+            std::deque<T> items;
+        };
+
+        std::vector<std::unique_ptr<_slot>> _slots;
+        std::atomic<std::size_t> _outstanding;
+
+    public:
+        explicit work_stealing_queue(std::size_t workers) : _outstanding(0)
+        {
+            if (workers == 0) workers = 1;
+            for (std::size_t i = 0; i < workers; i++)
+            {
+                _slots.push_back(std::make_unique<_slot>());
+            }
+        }
+
+        [[nodiscard]] std::size_t workers() const noexcept
+        {
+            return _slots.size();
+        }
+
+        void push(std::size_t worker, T item)
+        {
+            auto& slot = *_slots[worker % _slots.size()];
+            _outstanding++;
+            boost::lock_guard<boost::mutex> guard(slot.lock);
+            slot.items.push_back(std::move(item));
+        }
+
+        /**********************************************************************************************//**
+         * @fn	bool work_stealing_queue::pop(std::size_t worker, T& item)
+         *
+         * @brief	Takes the next item for the given worker, from its own queue if possible or else
+         * 			stolen from another worker.
+         *
+         * @param 	   	worker	The index of the calling worker.
+         * @param [out]	item  	Receives the item.
+         *
+         * @returns	true if an item was taken; otherwise false. Every item taken must later be passed to
+         * 			done().
+         **************************************************************************************************/
+
+        bool pop(std::size_t worker, T& item)
+        {
+            auto count = _slots.size();
+            auto own = worker % count;
+            {
+                auto& slot = *_slots[own];
+                boost::lock_guard<boost::mutex> guard(slot.lock);
+                if (!slot.items.empty())
+                {
+                    item = std::move(slot.items.back());
+                    slot.items.pop_back();
+                    return true;
+                }
+            }
+
+            for (std::size_t i = 1; i < count; i++)
+            {
+                auto& slot = *_slots[(own + i) % count];
+                boost::lock_guard<boost::mutex> guard(slot.lock);
+                if (!slot.items.empty())
+                {
+                    item = std::move(slot.items.front());
+                    slot.items.pop_front();
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void done() noexcept
+        {
+            _outstanding--;
+        }
+
+        [[nodiscard]] bool finished() const noexcept
+        {
+            return (_outstanding == 0);
+        }
+
+        /**********************************************************************************************//**
+         * @fn	template<typename FnT> void work_stealing_queue::run(std::size_t worker, FnT fn)
+         *
+         * @brief	Processes items on the calling thread until all of the work is finished.
+         *
+         * @tparam	FnT	A callable taking the worker index and an item, it may push further items.
+         * @param 	worker	The index of the calling worker.
+         * @param 	fn	  	The function that processes an item.
+         **************************************************************************************************/
+
+        template<typename FnT>
+        void run(std::size_t worker, FnT fn)
+        {
+            unsigned int idle = 0;
+            T item;
+            while (!finished())
+            {
+                if (!pop(worker, item))
+                {
+                    // Another worker is still producing, back off gently while waiting for something to steal.
+                    if (++idle < 64)
+                    {
+                        boost::this_thread::yield();
+                    }
+                    else
+                    {
+                        boost::this_thread::sleep_for(boost::chrono::microseconds(200));
+                    }
+                    continue;
+                }
+                idle = 0;
+                try
+                {
+                    fn(worker, item);
+                }
+                catch (...)
+                {
+                    done();
+                    throw;
+                }
+                done();
+            }
+        }
+    };
+}
+
+#endif //_THREAD_POOL_HPP_
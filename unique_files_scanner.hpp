@@ -134,7 +134,7 @@ namespace oasis::filesystem
 
             for (const auto& ds : _scanner._sets)
             {
-                _files.push_back(*(ds.second.begin()));
+                _files.push_back(_scanner._paths.path(_scanner._sets.members(ds).front()));
             }
         }
 